@@ -74,6 +74,7 @@ void StfBuilderDevice::InitTask()
   I().mDplChannelName = GetConfig()->GetValue<std::string>(OptionKeyDplChannelName);
   I().mStandalone = GetConfig()->GetValue<bool>(OptionKeyStandalone);
   I().mMaxStfsInPipeline = GetConfig()->GetValue<std::int64_t>(OptionKeyMaxBufferedStfs);
+  I().mNumaNode = GetConfig()->GetValue<int>(OptionKeyNumaNode);
 
   // input data handling
   ReadoutDataUtils::sSpecifiedDataOrigin = getDataOriginFromOption(
@@ -91,6 +92,50 @@ void StfBuilderDevice::InitTask()
   ReadoutDataUtils::sEmptyTriggerHBFrameFilterring =
     GetConfig()->GetValue<bool>(OptionKeyFilterEmptyTriggerData);
 
+  I().mNumBuilderThreads = std::max(std::uint64_t(1), GetConfig()->GetValue<std::uint64_t>(OptionKeyBuilderThreads));
+  DDLOGF(fair::Severity::info, "Configuration: SubTimeFrame building threads={}", I().mNumBuilderThreads);
+
+  // SubTimeFrame completion
+  {
+    const auto lModeStr = GetConfig()->GetValue<std::string>(OptionKeyStfCompletion);
+    if (lModeStr == "next-tf") {
+      I().mStfCompletion.mMode = eStfCompleteOnNextTf;
+    } else if (lModeStr == "equipment") {
+      I().mStfCompletion.mMode = eStfCompleteOnEquipment;
+    } else {
+      DDLOGF(fair::Severity::ERROR, "Configuration: unknown SubTimeFrame completion mode. {}={}",
+        OptionKeyStfCompletion, lModeStr);
+      exit(-1);
+    }
+
+    I().mStfCompletion.mExpectedEquipment = GetConfig()->GetValue<std::uint64_t>(OptionKeyStfExpectedEquipment);
+    I().mStfCompletion.mExpectedHbfs = GetConfig()->GetValue<std::uint64_t>(OptionKeyStfExpectedHbfs);
+    I().mStfCompletion.mTimeout = std::chrono::milliseconds(
+      std::max(std::uint64_t(1), GetConfig()->GetValue<std::uint64_t>(OptionKeyStfCompletionTimeout)));
+  }
+
+  // SubTimeFrame boundaries
+  {
+    const auto lModeStr = GetConfig()->GetValue<std::string>(OptionKeyStfBoundary);
+    if (lModeStr == "readout-id") {
+      I().mStfBoundary.mMode = eStfBoundaryReadoutId;
+    } else if (lModeStr == "orbit") {
+      I().mStfBoundary.mMode = eStfBoundaryOrbit;
+    } else {
+      DDLOGF(fair::Severity::ERROR, "Configuration: unknown SubTimeFrame boundary mode. {}={}",
+        OptionKeyStfBoundary, lModeStr);
+      exit(-1);
+    }
+
+    I().mStfBoundary.mHbfsPerTf = GetConfig()->GetValue<std::uint32_t>(OptionKeyStfHbfsPerTf);
+    I().mStfBoundary.mFirstOrbit = GetConfig()->GetValue<std::uint32_t>(OptionKeyStfFirstOrbit);
+    if (I().mStfBoundary.mHbfsPerTf == 0) {
+      DDLOGF(fair::Severity::ERROR, "Configuration: number of HBFrames per TF must be positive. {}={}",
+        OptionKeyStfHbfsPerTf, I().mStfBoundary.mHbfsPerTf);
+      exit(-1);
+    }
+  }
+
   // Buffering limitation
   if (I().mMaxStfsInPipeline > 0) {
     if (I().mMaxStfsInPipeline < 4) {
@@ -107,6 +152,99 @@ void StfBuilderDevice::InitTask()
       "Possibility of creating back-pressure.");
   }
 
+  // Output queue limits: backpressure from the file sink or the output channel
+  {
+    const auto lMaxStfs = GetConfig()->GetValue<std::uint64_t>(OptionKeyOutputQueueMaxStfs);
+    const auto lMaxSize = GetConfig()->GetValue<std::uint64_t>(OptionKeyOutputQueueMaxSize) << 20;
+    const auto lPolicyStr = GetConfig()->GetValue<std::string>(OptionKeyOutputQueuePolicy);
+
+    PipelineStagePolicy lPolicy = eStageBlock;
+    if (lPolicyStr == "block") {
+      lPolicy = eStageBlock;
+    } else if (lPolicyStr == "drop-oldest") {
+      lPolicy = eStageDropOldest;
+    } else if (lPolicyStr == "drop-newest") {
+      lPolicy = eStageDropNewest;
+    } else {
+      DDLOGF(fair::Severity::ERROR, "Configuration: unknown output queue policy. {}={}",
+        OptionKeyOutputQueuePolicy, lPolicyStr);
+      exit(-1);
+    }
+
+    if (lMaxStfs > 0 || lMaxSize > 0) {
+      setStageLimit(eStfFileSinkIn, lMaxStfs, lMaxSize, lPolicy);
+      setStageLimit(eStfSendIn, lMaxStfs, lMaxSize, lPolicy);
+      DDLOGF(fair::Severity::info, "Configuration: output queue limits max_stfs={} max_size_mb={} policy={}",
+        lMaxStfs, lMaxSize >> 20, lPolicyStr);
+    }
+  }
+
+  // NUMA placement of memory regions and building threads
+  if (I().mNumaNode != NumaUtils::cNoNode) {
+    if (!NumaUtils::nodeValid(I().mNumaNode)) {
+      DDLOGF(fair::Severity::ERROR, "Configuration: NUMA node does not exist. numa_node={}", I().mNumaNode);
+      exit(-1);
+    }
+    DDLOGF(fair::Severity::info, "Configuration: memory regions and building threads are placed on NUMA node {}",
+      I().mNumaNode);
+  }
+
+  // Header region: fixed or auto sized from the expected number of HBFrames and buffered STFs
+  {
+    const auto lHdrRegionSizeMiB = GetConfig()->GetValue<std::uint64_t>(OptionKeyHeaderRegionSize);
+    if (lHdrRegionSizeMiB > 0) {
+      I().mHeaderRegionSize = lHdrRegionSizeMiB << 20;
+    } else {
+      const auto lExpectedHbfs = GetConfig()->GetValue<std::uint64_t>(OptionKeyHeaderRegionHbfs);
+      const auto lStfs = I().mPipelineLimit ? std::uint64_t(I().mMaxStfsInPipeline) : cHeaderRegionAutoStfs;
+      // NOTE: DPL is not configured yet, assume the larger header size
+      const auto lObjSize = SubTimeFrameReadoutBuilder::headerObjectSize(true);
+
+      // round up to MiB, keep at least 16 MiB
+      I().mHeaderRegionSize = std::max(std::size_t(16) << 20,
+        ((lExpectedHbfs * lStfs * lObjSize + (std::size_t(1) << 20) - 1) >> 20) << 20);
+    }
+
+    DDLOGF(fair::Severity::info, "Configuration: header region size is {} MiB ({}).",
+      I().mHeaderRegionSize >> 20, (lHdrRegionSizeMiB > 0) ? "fixed" : "auto");
+
+    I().mHeaderChunkHbfs = GetConfig()->GetValue<std::uint64_t>(OptionKeyHeaderChunkHbfs);
+    if (I().mHeaderChunkHbfs > 0) {
+      const auto lChunkSize = I().mHeaderChunkHbfs * SubTimeFrameReadoutBuilder::headerObjectSize(true);
+      if (lChunkSize > I().mHeaderRegionSize / 16) {
+        DDLOGF(fair::Severity::ERROR, "Configuration: header chunk is too large for the header region. "
+          "chunk_hbfs={} chunk_size={} header_region_size={}", I().mHeaderChunkHbfs, lChunkSize,
+          I().mHeaderRegionSize);
+        exit(-1);
+      }
+      DDLOGF(fair::Severity::info, "Configuration: headers of each equipment are placed in chunks of {} headers.",
+        I().mHeaderChunkHbfs);
+    }
+  }
+
+  // HBFrame coalescing
+  {
+    I().mHbfCoalesceSize = GetConfig()->GetValue<std::uint64_t>(OptionKeyHbfCoalesceSize) << 10;
+    I().mHbfCoalesceRegionSize = GetConfig()->GetValue<std::uint64_t>(OptionKeyHbfCoalesceRegionSize) << 20;
+
+    if (I().mHbfCoalesceSize > 0) {
+      if (I().mHbfCoalesceRegionSize < I().mNumBuilderThreads * I().mHbfCoalesceSize * 16) {
+        DDLOGF(fair::Severity::ERROR, "Configuration: HBFrame coalescing region is too small. "
+          "coalesce_size={} region_size={} builder_threads={}", I().mHbfCoalesceSize, I().mHbfCoalesceRegionSize,
+          I().mNumBuilderThreads);
+        exit(-1);
+      }
+      DDLOGF(fair::Severity::info, "Configuration: HBFrames of each equipment are merged into payloads of up to {} kiB.",
+        I().mHbfCoalesceSize >> 10);
+    }
+  }
+
+  // Link statistics
+  if (GetConfig()->GetValue<bool>(OptionKeyLinkStats)) {
+    I().mLinkStats = std::make_shared<LinkStatsCollector>();
+    DDLOGF(fair::Severity::info, "Configuration: per link statistics are enabled.");
+  }
+
   // File sink
   if (!I().mFileSink->loadVerifyConfig(*(this->GetConfig()))) {
     exit(-1);
@@ -217,11 +355,11 @@ void StfBuilderDevice::InitTask()
 
   // start file source
   // channel for FileSource: stf or dpl, or generic one in case of standalone
-  I().mFileSource->start(getOutputChannel(), I().mDplEnabled);
+  I().mFileSource->start(getOutputChannel(), I().mDplEnabled, I().mNumaNode);
 
   // start a thread for readout process
   if (!I().mFileSource->enabled()) {
-    I().mReadoutInterface->start(1);
+    I().mReadoutInterface->start(I().mNumBuilderThreads, I().mStfCompletion, I().mStfBoundary);
   }
 
   // info thread
@@ -285,11 +423,14 @@ void StfBuilderDevice::StfOutputThread()
     }
   }
 
+  // drain bursts of small STFs with a single queue lock
+  StageBatch lSendInput(*this, eStfSendIn);
+
   while (IsRunningState()) {
     using hres_clock = std::chrono::high_resolution_clock;
 
     // Get a STF ready for sending
-    std::unique_ptr<SubTimeFrame> lStf = dequeue(eStfSendIn);
+    std::unique_ptr<SubTimeFrame> lStf = lSendInput.next();
     if (!lStf)
       break;
 
@@ -305,7 +446,7 @@ void StfBuilderDevice::StfOutputThread()
     }
 
     // get data size sample
-    I().mStfSizeSamples.Fill(lStf->getDataSize());
+    I().mStfSizeHist.Fill(lStf->getDataSize());
 
     if (!isSandalone()) {
       const auto lSendStartTime = hres_clock::now();
@@ -330,8 +471,8 @@ void StfBuilderDevice::StfOutputThread()
       }
 
       // record time spent in sending
-      double lTimeMs = std::chrono::duration<double, std::milli>(hres_clock::now() - lSendStartTime).count();
-      I().mStfDataTimeSamples.Fill(lTimeMs);
+      const auto lTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(hres_clock::now() - lSendStartTime);
+      I().mStfSendTimeHist.Fill(lTimeUs.count());
     } else {
       // DDLOGF(fair::Severity::ERROR, "Dropping stf size={}", lStf->getDataSize());
     }
@@ -345,17 +486,101 @@ void StfBuilderDevice::InfoThread()
   // wait for the device to go into RUNNING state
   WaitForRunningState();
 
+  LinkStatsMap lPrevLinkStats;
+  auto lPrevLinkStatsTime = std::chrono::steady_clock::now();
+
   while (IsRunningState()) {
 
-    DDLOGF(fair::Severity::info, "SubTimeFrame size_mean={} frequency_mean={} sending_time_ms_mean={} queued_stf={}",
-      I().mStfSizeSamples.Mean(), I().mReadoutInterface->StfFreqSamples().Mean(), I().mStfDataTimeSamples.Mean(),
-      I().mNumStfs);
+    {
+      const auto lSize = I().mStfSizeHist.Window();
+      const auto lInterval = I().mReadoutInterface->StfIntervalHistogram().Window();
+      const auto lSendTime = I().mStfSendTimeHist.Window();
+
+      DDLOGF(fair::Severity::info, "SubTimeFrame size_mean={} size_p50={} size_p99={} size_p999={} "
+        "build_rate={:.2f} send_rate={:.2f} queued_stf={}",
+        lSize.Mean(), lSize.Quantile(0.5), lSize.Quantile(0.99), lSize.Quantile(0.999),
+        lInterval.Rate(), lSize.Rate(), I().mNumStfs);
+      DDLOGF(fair::Severity::info, "SubTimeFrame sending_time_us_p50={} sending_time_us_p99={} sending_time_us_p999={}",
+        lSendTime.Quantile(0.5), lSendTime.Quantile(0.99), lSendTime.Quantile(0.999));
+    }
+
+    const auto lHdrFallbacks = I().mReadoutInterface->headerFallbackCount() + I().mFileSource->headerFallbackCount();
+    if (lHdrFallbacks > 0) {
+      DDLOGF(fair::Severity::WARNING, "Header region exhausted, headers allocated from the global SHM segment. "
+        "fallback_allocations={} header_region_size={}", lHdrFallbacks, I().mHeaderRegionSize);
+    }
+
+    logPipelineStats({ "file_sink", "send" });
+
+    const auto lQueueDrops = getStageDropCount(eStfFileSinkIn) + getStageDropCount(eStfSendIn);
+    if (lQueueDrops > 0) {
+      DDLOGF(fair::Severity::WARNING, "Output queue limits dropped SubTimeFrames. file_sink_dropped={} send_dropped={}",
+        getStageDropCount(eStfFileSinkIn), getStageDropCount(eStfSendIn));
+    }
+
+    std::vector<RegionStats> lRegionStats;
+    I().mReadoutInterface->regionStats(lRegionStats);
+    I().mFileSource->regionStats(lRegionStats);
+    for (const auto &lStats : lRegionStats) {
+      logRegionStats(lStats);
+    }
+
+    if (I().mLinkStats) {
+      const auto lNow = std::chrono::steady_clock::now();
+      logLinkStats(lPrevLinkStats, std::chrono::duration<double>(lNow - lPrevLinkStatsTime).count());
+      lPrevLinkStatsTime = lNow;
+    }
 
     std::this_thread::sleep_for(2s);
   }
   DDLOGF(fair::Severity::trace, "Exiting Info thread...");
 }
 
+/// Log the link statistics of the last window. Links with errors, orbit gaps, or without data are reported as warnings.
+void StfBuilderDevice::logLinkStats(LinkStatsMap &pPrevStats, const double pWindowSec)
+{
+  const auto lStats = I().mLinkStats->snapshot();
+  const double lWindowSec = std::max(pWindowSec, 1e-3);
+
+  std::size_t lNumLinks = 0;
+  std::size_t lNumBadLinks = 0;
+  std::uint64_t lBytes = 0;
+
+  for (const auto &lLink : lStats) {
+    const auto &lTotal = lLink.second;
+    const auto &lPrev = pPrevStats[lLink.first];
+
+    const auto lHbfs = lTotal.mHbfs - lPrev.mHbfs;
+    const auto lEmptyHbfs = lTotal.mEmptyHbfs - lPrev.mEmptyHbfs;
+    const auto lRdhErrors = lTotal.mRdhErrors - lPrev.mRdhErrors;
+    const auto lOrbitGaps = lTotal.mOrbitGaps - lPrev.mOrbitGaps;
+    const auto lMissingOrbits = lTotal.mMissingOrbits - lPrev.mMissingOrbits;
+    const auto lLinkBytes = lTotal.mBytes - lPrev.mBytes;
+
+    lNumLinks++;
+    lBytes += lLinkBytes;
+
+    const bool lBad = (lHbfs == 0) || (lRdhErrors > 0) || (lOrbitGaps > 0);
+    if (lBad) {
+      lNumBadLinks++;
+    }
+
+    DDLOGF(lBad ? fair::Severity::WARNING : fair::Severity::DEBUG, "Link subspec={:#010x} hbf_rate={:.2f} "
+      "data_rate_mbps={:.3f} pages={} empty_hbfs={} rdh_errors={} orbit_gaps={} missing_orbits={} trigger_types={:#x} "
+      "total_hbfs={} total_rdh_errors={} total_orbit_gaps={}",
+      lLink.first, double(lHbfs) / lWindowSec, double(lLinkBytes) / lWindowSec / double(1ULL << 20),
+      lTotal.mPages - lPrev.mPages, lEmptyHbfs, lRdhErrors, lOrbitGaps, lMissingOrbits, lTotal.mTriggerTypes,
+      lTotal.mHbfs, lTotal.mRdhErrors, lTotal.mOrbitGaps);
+  }
+
+  if (lNumLinks > 0) {
+    DDLOGF(fair::Severity::info, "Link statistics links={} bad_links={} data_rate_mbps={:.3f}",
+      lNumLinks, lNumBadLinks, double(lBytes) / lWindowSec / double(1ULL << 20));
+  }
+
+  pPrevStats = lStats;
+}
+
 bool StfBuilderDevice::ConditionalRun()
 {
   // nothing to do here sleep for awhile
@@ -394,7 +619,57 @@ bpo::options_description StfBuilderDevice::getStfBuildingProgramOptions() {
     "Enable extensive RDH verification. Permitted values: off, print, drop (caution, any data not meeting criteria will be dropped)")(
     OptionKeyFilterEmptyTriggerData,
     bpo::bool_switch()->default_value(false),
-    "Filter out empty HBFrames with RDHv4 sent in triggered mode.");
+    "Filter out empty HBFrames with RDHv4 sent in triggered mode.")(
+    OptionKeyHeaderRegionSize,
+    bpo::value<std::uint64_t>()->default_value(256),
+    "Size of the shared memory region for O2 headers (in MiB). Auto sizing: 0")(
+    OptionKeyHeaderRegionHbfs,
+    bpo::value<std::uint64_t>()->default_value(8192),
+    "Expected number of HBFrames in a SubTimeFrame. Used to size the header region when auto sizing is selected.")(
+    OptionKeyHeaderChunkHbfs,
+    bpo::value<std::uint64_t>()->default_value(0),
+    "Place the O2 headers of each equipment contiguously, in chunks of the given number of headers. "
+    "0: each header is allocated individually.")(
+    OptionKeyHbfCoalesceSize,
+    bpo::value<std::uint64_t>()->default_value(0),
+    "Merge consecutive HBFrames of each equipment into payloads of up to the given size (in kiB). "
+    "HBFrames are copied into a separate memory region. 0: disabled.")(
+    OptionKeyHbfCoalesceRegionSize,
+    bpo::value<std::uint64_t>()->default_value(1024),
+    "Size of the shared memory region for merged HBFrames (in MiB), divided among the building threads.")(
+    OptionKeyLinkStats,
+    bpo::bool_switch()->default_value(false),
+    "Collect per link statistics (data rate, pages, empty HBFrames, RDH errors, orbit gaps, trigger types).")(
+    OptionKeyBuilderThreads,
+    bpo::value<std::uint64_t>()->default_value(1),
+    "Number of SubTimeFrame building threads. Each SubTimeFrame is built by a single thread; "
+    "idle threads take over pending SubTimeFrames of busy threads. SubTimeFrames are forwarded in TF order.")(
+    OptionKeyStfCompletion,
+    bpo::value<std::string>()->default_value("next-tf"),
+    "SubTimeFrame completion: 'next-tf' (when data of the next TF arrives), "
+    "'equipment' (when all expected equipment delivered its data).")(
+    OptionKeyStfExpectedEquipment,
+    bpo::value<std::uint64_t>()->default_value(0),
+    "Number of equipment expected in each SubTimeFrame ('equipment' completion). "
+    "0: expect the equipment that sent data within the completion timeout.")(
+    OptionKeyStfExpectedHbfs,
+    bpo::value<std::uint64_t>()->default_value(0),
+    "Number of HBFrames expected from each equipment in a SubTimeFrame ('equipment' completion). "
+    "0: the number of HBFrames in a TF (stf-hbfs-per-tf).")(
+    OptionKeyStfCompletionTimeout,
+    bpo::value<std::uint64_t>()->default_value(2000),
+    "Time without new data after which a SubTimeFrame is completed (in ms).")(
+    OptionKeyStfBoundary,
+    bpo::value<std::string>()->default_value("readout-id"),
+    "SubTimeFrame boundaries: 'readout-id' (TF id sent by readout), "
+    "'orbit' (TF id computed from the RDH orbit, aligned on all FLPs).")(
+    OptionKeyStfHbfsPerTf,
+    bpo::value<std::uint32_t>()->default_value(256),
+    "Number of HBFrames (orbits) in a TF, with 'orbit' boundaries. "
+    "Also the default of stf-expected-hbfs.")(
+    OptionKeyStfFirstOrbit,
+    bpo::value<std::uint32_t>()->default_value(0),
+    "Orbit of the first TF, with 'orbit' boundaries. Must be the same on all FLPs.");
 
   return lStfBuildingOptions;
 }
@@ -22,6 +22,7 @@
 #include <SubTimeFrameFileSource.h>
 #include <ConcurrentQueue.h>
 #include <Utilities.h>
+#include <NumaUtils.h>
 
 #include <deque>
 #include <memory>
@@ -65,6 +66,10 @@ class StfBuilderDevice : public DataDistDevice,
   static constexpr const char* OptionKeyDplChannelName = "dpl-channel-name";
   static constexpr const char* OptionKeyStandalone = "stand-alone";
   static constexpr const char* OptionKeyMaxBufferedStfs = "max-buffered-stfs";
+  static constexpr const char* OptionKeyNumaNode = "numa-node";
+  static constexpr const char* OptionKeyOutputQueueMaxStfs = "output-queue-max-stfs";
+  static constexpr const char* OptionKeyOutputQueueMaxSize = "output-queue-max-size";
+  static constexpr const char* OptionKeyOutputQueuePolicy = "output-queue-policy";
 
   static constexpr const char* OptionKeyStfDetector = "detector";
   static constexpr const char* OptionKeyRhdVer = "detector-rdh";
@@ -73,6 +78,24 @@ class StfBuilderDevice : public DataDistDevice,
   static constexpr const char* OptionKeyRdhSanityCheck = "rdh-data-check";
   static constexpr const char* OptionKeyFilterEmptyTriggerData = "rdh-filter-empty-trigger";
 
+  static constexpr const char* OptionKeyHeaderRegionSize = "header-region-size";
+  static constexpr const char* OptionKeyHeaderRegionHbfs = "header-region-hbfs";
+  static constexpr const char* OptionKeyHeaderChunkHbfs = "header-chunk-hbfs";
+  static constexpr const char* OptionKeyHbfCoalesceSize = "hbf-coalesce-size";
+  static constexpr const char* OptionKeyHbfCoalesceRegionSize = "hbf-coalesce-region-size";
+  static constexpr const char* OptionKeyLinkStats = "link-stats";
+  static constexpr const char* OptionKeyBuilderThreads = "stf-builder-threads";
+  static constexpr const char* OptionKeyStfCompletion = "stf-completion";
+  static constexpr const char* OptionKeyStfExpectedEquipment = "stf-expected-equipment";
+  static constexpr const char* OptionKeyStfExpectedHbfs = "stf-expected-hbfs";
+  static constexpr const char* OptionKeyStfCompletionTimeout = "stf-completion-timeout";
+  static constexpr const char* OptionKeyStfBoundary = "stf-boundary";
+  static constexpr const char* OptionKeyStfHbfsPerTf = "stf-hbfs-per-tf";
+  static constexpr const char* OptionKeyStfFirstOrbit = "stf-first-orbit";
+
+  /// pipeline depth assumed for header region auto sizing when the number of buffered STFs is not limited
+  static constexpr std::uint64_t cHeaderRegionAutoStfs = 64;
+
   static bpo::options_description getDetectorProgramOptions();
   static bpo::options_description getStfBuildingProgramOptions();
   static o2::header::DataOrigin getDataOriginFromOption(const std::string pArg);
@@ -85,8 +108,20 @@ class StfBuilderDevice : public DataDistDevice,
 
   bool dplEnabled() const noexcept { return I().mDplEnabled; }
   bool isSandalone() const noexcept { return I().mStandalone; }
+  int numaNode() const noexcept { return I().mNumaNode; }
+  std::size_t headerRegionSize() const noexcept { return I().mHeaderRegionSize; }
+  std::size_t headerChunkHbfs() const noexcept { return I().mHeaderChunkHbfs; }
+  std::size_t hbfCoalesceSize() const noexcept { return I().mHbfCoalesceSize; }
+  std::size_t hbfCoalesceRegionSize() const noexcept { return I().mHbfCoalesceRegionSize; }
+  std::shared_ptr<LinkStatsCollector> linkStats() const noexcept { return I().mLinkStats; }
 
   const std::string& getInputChannelName() const { return I().mInputChannelName; }
+
+  /// Number of sub-channels (sockets) of the input channel
+  std::size_t getInputChannelCount() const {
+    const auto lIt = fChannels.find(I().mInputChannelName);
+    return (lIt != fChannels.end()) ? lIt->second.size() : 0;
+  }
   const std::string& getDplChannelName() const { return I().mDplChannelName; }
 
   auto& getOutputChannel() {
@@ -174,8 +209,27 @@ class StfBuilderDevice : public DataDistDevice,
     return lNextStage;
   }
 
+  std::size_t getPipelineElementSize(const std::unique_ptr<SubTimeFrame> &pStf) const final
+  {
+    return pStf ? pStf->getDataSize() : 0;
+  }
+
+  void onPipelineDrop(unsigned pStage, const std::unique_ptr<SubTimeFrame> &pStf) final
+  {
+    // STFs are counted only in the sending stage
+    if (pStage == eStfSendIn) {
+      I().mNumStfs--;
+    }
+
+    if (getStageDropCount(pStage) % 100 == 1) {
+      DDLOGF(fair::Severity::WARNING, "Output queue limit reached. Dropping STF. stage={} stf_id={} total_dropped={}",
+        pStage, (pStf ? pStf->header().mId : 0), getStageDropCount(pStage));
+    }
+  }
+
   void StfOutputThread();
   void InfoThread();
+  void logLinkStats(LinkStatsMap &pPrevStats, const double pWindowSec);
 
   struct StfBuilderInstance {
     /// config
@@ -186,6 +240,15 @@ class StfBuilderDevice : public DataDistDevice,
     bool mDplEnabled;
     std::int64_t mMaxStfsInPipeline;
     bool mPipelineLimit;
+    int mNumaNode = NumaUtils::cNoNode;
+    std::size_t mHeaderRegionSize;
+    std::size_t mHeaderChunkHbfs = 0;
+    std::size_t mHbfCoalesceSize = 0;
+    std::size_t mHbfCoalesceRegionSize = 0;
+    std::shared_ptr<LinkStatsCollector> mLinkStats; // null when disabled
+    std::size_t mNumBuilderThreads = 1;
+    StfCompletionConfig mStfCompletion;
+    StfBoundaryConfig mStfBoundary;
 
     /// Input Interface handler
     std::unique_ptr<StfInputInterface> mReadoutInterface;
@@ -203,8 +266,8 @@ class StfBuilderDevice : public DataDistDevice,
 
     /// Info thread
     std::thread mInfoThread;
-    RunningSamples<uint64_t> mStfSizeSamples;
-    RunningSamples<float> mStfDataTimeSamples;
+    PercentileHistogram<> mStfSizeHist;     // bytes
+    PercentileHistogram<> mStfSendTimeHist; // us
   };
 
   std::unique_ptr<StfBuilderInstance> mI;
@@ -23,6 +23,8 @@
 
 #include <vector>
 #include <queue>
+#include <limits>
+#include <algorithm>
 #include <chrono>
 #include <sstream>
 
@@ -31,28 +33,84 @@ namespace o2
 namespace DataDistribution
 {
 
-void StfInputInterface::start(const std::size_t pNumBuilders)
+void StfInputInterface::start(const std::size_t pNumBuilders, const StfCompletionConfig &pCompletion,
+  const StfBoundaryConfig &pBoundary)
 {
-  mNumBuilders = pNumBuilders;
+  mNumBuilders = std::max(std::size_t(1), pNumBuilders);
+  mCompletion = pCompletion;
+  mBoundary = pBoundary;
+  mBoundary.mHbfsPerTf = std::max(std::uint32_t(1), mBoundary.mHbfsPerTf);
+  // 0: all HBFrames of the TF. An equipment sending its data in several updates is not complete after the first one.
+  if (mCompletion.mExpectedHbfs == 0) {
+    mCompletion.mExpectedHbfs = mBoundary.mHbfsPerTf;
+  }
+  mNextBuilder = 0;
+  mStolenTasks = 0;
   mRunning = true;
 
   mBuilderInputQueues.clear();
   mBuilderInputQueues.resize(mNumBuilders);
 
+  // one receiving thread per sub-channel of the input channel
+  const auto lNumInputChannels = std::max(std::size_t(1), mDevice.getInputChannelCount());
+  {
+    std::scoped_lock lLock(mStfAssemblyLock);
+    mStfsInAssembly.clear();
+    mInputChannelStates.clear();
+    mInputChannelStates.resize(lNumInputChannels);
+    mLastDispatchedStfId = -1;
+    mLateUpdates = 0;
+    mKnownEquipment.clear();
+    mStfsCompleteOnEquipment = 0;
+    mNextDispatchSeq = 0;
+  }
+
+  {
+    std::scoped_lock lLock(mReorderLock);
+    mReorderStfs.clear();
+    mNextOutputSeq = 0;
+  }
+
   // Reference to the output or DPL channel
   // const auto &lOutChanName = mDevice.getOutputChannelName();
   auto& lOutputChan = mDevice.getOutputChannel();
 
+  // one header pool for all builders: header memory does not grow with the number of threads
+  auto lHeaderPool = SubTimeFrameReadoutBuilder::createHeaderPool(lOutputChan, mDevice.headerRegionSize(),
+    mDevice.dplEnabled(), mDevice.numaNode(), mDevice.headerChunkHbfs());
+  std::atomic_store(&mHeaderPool, lHeaderPool);
+
   // NOTE: create the mStfBuilders first to avid resizing the vector; then threads
   for (std::size_t i = 0; i < mNumBuilders; i++) {
-    mStfBuilders.emplace_back(lOutputChan, mDevice.dplEnabled());
+    mStfBuilders.emplace_back(lHeaderPool, mDevice.dplEnabled());
+
+    if (mDevice.hbfCoalesceSize() > 0) {
+      mStfBuilders.back().enableHbfCoalescing(lOutputChan, mDevice.hbfCoalesceRegionSize() / mNumBuilders,
+        mDevice.hbfCoalesceSize(), mDevice.numaNode());
+    }
+
+    if (mDevice.linkStats()) {
+      mStfBuilders.back().enableLinkStats(mDevice.linkStats());
+    }
   }
 
   for (std::size_t i = 0; i < mNumBuilders; i++) {
     mBuilderThreads.emplace_back(std::thread(&StfInputInterface::StfBuilderThread, this, i));
   }
 
-  mInputThread = std::thread(&StfInputInterface::DataHandlerThread, this, 0);
+  for (unsigned i = 0; i < lNumInputChannels; i++) {
+    mInputThreads.emplace_back(std::thread(&StfInputInterface::DataHandlerThread, this, i));
+  }
+
+  DDLOGF(fair::Severity::info, "INPUT INTERFACE: started. input_channels={} builder_threads={} "
+    "stf_completion={} expected_equipment={} expected_hbfs={} completion_timeout_ms={}",
+    lNumInputChannels, mNumBuilders, (mCompletion.mMode == eStfCompleteOnEquipment ? "equipment" : "next-tf"),
+    mCompletion.mExpectedEquipment, mCompletion.mExpectedHbfs, mCompletion.mTimeout.count());
+
+  if (mBoundary.mMode == eStfBoundaryOrbit) {
+    DDLOGF(fair::Severity::info, "INPUT INTERFACE: TF id is computed from the RDH orbit. hbfs_per_tf={} first_orbit={}",
+      mBoundary.mHbfsPerTf, mBoundary.mFirstOrbit);
+  }
 }
 
 void StfInputInterface::stop()
@@ -63,14 +121,18 @@ void StfInputInterface::stop()
     lBuilder.stop();
   }
 
-  if (mInputThread.joinable()) {
-    mInputThread.join();
-  }
-
+  // NOTE: stop the queues first: the input thread can be blocked on a full builder queue
   for (auto &lQueue : mBuilderInputQueues) {
     lQueue.stop();
   }
 
+  for (auto &lInputThread : mInputThreads) {
+    if (lInputThread.joinable()) {
+      lInputThread.join();
+    }
+  }
+  mInputThreads.clear();
+
   for (auto &lBldThread : mBuilderThreads) {
     if (lBldThread.joinable()) {
       lBldThread.join();
@@ -81,12 +143,29 @@ void StfInputInterface::stop()
   mBuilderThreads.clear();
   mBuilderInputQueues.clear();
 
-  DDLOGF(fair::Severity::trace, "INPUT INTERFACE: Stopped.");
+  {
+    std::scoped_lock lLock(mStfAssemblyLock);
+    mStfsInAssembly.clear();
+  }
+
+  {
+    std::scoped_lock lLock(mReorderLock);
+    mReorderStfs.clear();
+  }
+
+  DDLOGF(fair::Severity::DEBUG, "INPUT INTERFACE: Stopped. builder_threads={} stolen_tasks={} late_updates={} "
+    "stfs_complete_on_equipment={}", mNumBuilders, mStolenTasks, mLateUpdates, mStfsCompleteOnEquipment);
 }
 
 /// Receiving thread
 void StfInputInterface::DataHandlerThread(const unsigned pInputChannelIdx)
 {
+  if (mDevice.numaNode() != NumaUtils::cNoNode) {
+    NumaUtils::pinThread(mDevice.numaNode());
+  }
+
+  using namespace std::chrono_literals;
+
   std::vector<FairMQMessagePtr> lReadoutMsgs;
   lReadoutMsgs.reserve(1U << 20);
   // current TF Id
@@ -95,6 +174,9 @@ void StfInputInterface::DataHandlerThread(const unsigned pInputChannelIdx)
   // Reference to the input channel
   auto& lInputChan = mDevice.GetChannel(mDevice.getInputChannelName(), pInputChannelIdx);
 
+  // check often enough for the completion fallback timeout
+  const int lReceiveTimeoutMs = std::clamp(int(mCompletion.mTimeout.count() / 4), 1, 100);
+
   try {
     while (mRunning) {
 
@@ -103,10 +185,17 @@ void StfInputInterface::DataHandlerThread(const unsigned pInputChannelIdx)
       lReadoutMsgs.clear();
 
       // receive readout messages
-      const auto lRet = lInputChan.Receive(lReadoutMsgs);
+      const auto lRet = lInputChan.Receive(lReadoutMsgs, lReceiveTimeoutMs);
+
+      // timeout ? finish TFs without updates
+      if (lRet == -2) {
+        std::scoped_lock lLock(mStfAssemblyLock);
+        dispatchCompleteStfs();
+        continue;
+      }
+
       if (lRet < 0 && mRunning) {
         // DDLOG(fair::Severity::WARNING) << "StfHeader receive failed (err = " + std::to_string(lRet) + ")";
-        using namespace std::chrono_literals;
         std::this_thread::sleep_for(500ms);
         continue;
       } else if (lRet < 0) {
@@ -122,6 +211,12 @@ void StfInputInterface::DataHandlerThread(const unsigned pInputChannelIdx)
       assert(lReadoutMsgs[0]->GetSize() == sizeof(ReadoutSubTimeframeHeader));
       std::memcpy(&lReadoutHdr, lReadoutMsgs[0]->GetData(), sizeof(ReadoutSubTimeframeHeader));
 
+      // TF boundaries from the orbit: the readout TF id is not used
+      if (mBoundary.mMode == eStfBoundaryOrbit) {
+        assembleOrbitStfUpdates(lInputChan, pInputChannelIdx, lReadoutHdr, std::move(lReadoutMsgs));
+        continue;
+      }
+
       {
         static thread_local std::uint64_t sNumContIncProblems = 0;
         static thread_local std::uint64_t sNumContDecProblems = 0;
@@ -162,7 +257,8 @@ void StfInputInterface::DataHandlerThread(const unsigned pInputChannelIdx)
       // make sure we never jump down
       lCurrentStfId = std::max(lCurrentStfId, std::uint64_t(lReadoutHdr.mTimeFrameId));
 
-      mBuilderInputQueues[lReadoutHdr.mTimeFrameId % mNumBuilders].push(std::move(lReadoutMsgs));
+      const auto lEquipment = updateEquipment(lReadoutMsgs);
+      assembleStfUpdate(pInputChannelIdx, lReadoutHdr, lEquipment, std::move(lReadoutMsgs));
     }
   } catch (std::runtime_error& e) {
     DDLOGF(fair::Severity::ERROR, "Input channel receive failed. Stopping input thread...");
@@ -172,212 +268,467 @@ void StfInputInterface::DataHandlerThread(const unsigned pInputChannelIdx)
   DDLOGF(fair::Severity::trace, "Exiting the input thread...");
 }
 
-/// StfBuilding thread
-void StfInputInterface::StfBuilderThread(const std::size_t pIdx)
+/// Equipment of the update, for the STF completion accounting
+header::DataHeader::SubSpecificationType
+StfInputInterface::updateEquipment(const std::vector<FairMQMessagePtr> &pReadoutMsgs) const
 {
-  using namespace std::chrono_literals;
-  // current TF Id
-  std::int64_t lCurrentStfId = 0;
-  std::vector<FairMQMessagePtr> lReadoutMsgs;
-  lReadoutMsgs.reserve(1U << 20);
+  if (mCompletion.mMode == eStfCompleteOnEquipment && pReadoutMsgs.size() > 1) {
+    try {
+      const auto &lMsg = pReadoutMsgs[1];
+      const auto lVer = ReadoutDataUtils::rdhVersion(reinterpret_cast<const char*>(lMsg->GetData()), lMsg->GetSize());
+      return ReadoutDataUtils::dispatchRdhVersion(lVer, [&](auto pTag) {
+        return ReadoutDataUtils::getSubSpecification(RDHReaderT<typename decltype(pTag)::type>(lMsg));
+      });
+    } catch (RDHReaderException &e) {
+      // the update is discarded by the builder
+    }
+  }
+  return ~header::DataHeader::SubSpecificationType(0);
+}
 
-  // Reference to the input channel
-  assert (mBuilderInputQueues.size() == mNumBuilders);
-  assert (pIdx < mBuilderInputQueues.size());
-  auto &lInputQueue = mBuilderInputQueues[pIdx];
+/// Split the update at the TF boundaries given by the orbit of the HBFrames
+void StfInputInterface::assembleOrbitStfUpdates(FairMQChannel &pInputChan, const unsigned pInputChannelIdx,
+  ReadoutSubTimeframeHeader &pReadoutHdr, std::vector<FairMQMessagePtr> &&pReadoutMsgs)
+{
+  if (pReadoutMsgs.size() < 2) {
+    DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: no data sent, only header.");
+    return;
+  }
 
-  // Stf builder
-  SubTimeFrameReadoutBuilder &lStfBuilder = mStfBuilders[pIdx];
+  // select the RDH version once for the orbit lookup of all HBFrames
+  try {
+    const auto &lMsg = pReadoutMsgs[1];
+    const auto lVer = ReadoutDataUtils::rdhVersion(reinterpret_cast<const char*>(lMsg->GetData()), lMsg->GetSize());
+    ReadoutDataUtils::dispatchRdhVersion(lVer, [&](auto pTag) {
+      assembleOrbitStfUpdatesImpl<typename decltype(pTag)::type>(pInputChan, pInputChannelIdx, pReadoutHdr,
+        std::move(pReadoutMsgs));
+    });
+  } catch (RDHReaderException &e) {
+    DDLOGF(fair::Severity::ERROR, e.what());
+  }
+}
 
-  const std::chrono::microseconds cMinWaitTime = 2s;
-  const std::chrono::microseconds cDesiredWaitTime = 2s * mNumBuilders / 3;
-  const auto cStfDataWaitFor = std::max(cMinWaitTime, cDesiredWaitTime);
+template <typename RDH>
+void StfInputInterface::assembleOrbitStfUpdatesImpl(FairMQChannel &pInputChan, const unsigned pInputChannelIdx,
+  ReadoutSubTimeframeHeader &pReadoutHdr, std::vector<FairMQMessagePtr> &&pReadoutMsgs)
+{
+  auto lAssemblePart = [&](std::vector<FairMQMessagePtr> &&pPart, const std::uint32_t pStfId) {
+    pReadoutHdr.mTimeFrameId = pStfId;
+    pReadoutHdr.mNumberHbf = pPart.size() - 1;
+    std::memcpy(pPart[0]->GetData(), &pReadoutHdr, sizeof(ReadoutSubTimeframeHeader));
+
+    const auto lEquipment = updateEquipment(pPart);
+    assembleStfUpdate(pInputChannelIdx, pReadoutHdr, lEquipment, std::move(pPart));
+  };
+
+  std::int64_t lCurrentStfId = -1;
+  std::vector<FairMQMessagePtr> lPart;
+  lPart.reserve(pReadoutMsgs.size());
+  lPart.push_back(std::move(pReadoutMsgs[0]));
+
+  for (std::size_t i = 1; i < pReadoutMsgs.size(); i++) {
+    std::int64_t lStfId = lCurrentStfId;
+    try {
+      const auto lOrbit = RDHReaderT<RDH>(pReadoutMsgs[i]).getOrbit();
+      if (lOrbit >= mBoundary.mFirstOrbit) {
+        lStfId = mBoundary.stfId(lOrbit);
+      } else {
+        static thread_local std::uint64_t sNumEarlyOrbits = 0;
+        if (sNumEarlyOrbits++ % 1000 == 0) {
+          DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: HBFrame orbit is before the first TF orbit. "
+            "orbit={} first_orbit={} total_occurrences={}", lOrbit, mBoundary.mFirstOrbit, sNumEarlyOrbits);
+        }
+      }
+    } catch (RDHReaderException &e) {
+      // keep in the current TF: reported and discarded by the builder
+    }
 
-  using hres_clock = std::chrono::high_resolution_clock;
-  auto lStfStartTime = hres_clock::now();
+    // TF boundary: hand out the HBFrames of the previous TF with a copy of the readout header
+    if (lStfId != lCurrentStfId && lCurrentStfId >= 0 && lPart.size() > 1) {
+      lAssemblePart(std::move(lPart), std::uint32_t(lCurrentStfId));
 
-    while (mRunning) {
+      lPart = std::vector<FairMQMessagePtr>();
+      lPart.reserve(pReadoutMsgs.size() - i + 1);
+      lPart.push_back(pInputChan.NewMessage(sizeof(ReadoutSubTimeframeHeader)));
+    }
 
-      // Equipment ID for the HBFrames (from the header)
-      lReadoutMsgs.clear();
+    lCurrentStfId = lStfId;
+    lPart.push_back(std::move(pReadoutMsgs[i]));
+  }
 
-      // receive readout messages
-      const auto lRet = lInputQueue.pop_wait_for(lReadoutMsgs, cStfDataWaitFor);
-      if (!lRet && mRunning) {
+  if (lCurrentStfId < 0) {
+    static thread_local std::uint64_t sNumNoOrbit = 0;
+    if (sNumNoOrbit++ % 1000 == 0) {
+      DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: cannot determine the TF of the update from the orbit. "
+        "Data is dropped. total_occurrences={}", sNumNoOrbit);
+    }
+    return;
+  }
 
-        // timeout! should finish the Stf if have outstanding data
-        std::unique_ptr<SubTimeFrame> lStf = lStfBuilder.getStf();
+  lAssemblePart(std::move(lPart), std::uint32_t(lCurrentStfId));
+}
 
-        if (lStf) {
-         DDLOGF(fair::Severity::WARNING, "READOUT INTERFACE: finishing STF on a timeout. stf_id={} size={}",
-          lStf->header().mId, lStf->getDataSize());
+/// Add the update to its TF and hand out the TFs completed by it
+void StfInputInterface::assembleStfUpdate(const unsigned pInputChannelIdx, const ReadoutSubTimeframeHeader &pReadoutHdr,
+  const header::DataHeader::SubSpecificationType pEquipment, std::vector<FairMQMessagePtr> &&pReadoutMsgs)
+{
+  const auto lNow = std::chrono::steady_clock::now();
+  const std::uint64_t lStfId = pReadoutHdr.mTimeFrameId;
 
-          mDevice.queue(eStfBuilderOut, std::move(lStf));
+  std::scoped_lock lLock(mStfAssemblyLock);
 
-          { // MON: data of a new STF received, get the freq and new start time
-            const auto lStfDur = std::chrono::duration<float>(hres_clock::now() - lStfStartTime);
-            mStfFreqSamples.Fill(1.0f / lStfDur.count() * mNumBuilders);
-            lStfStartTime = hres_clock::now();
-          }
-        }
+  // the equipment is expected in the next TFs, also when this update is late
+  if (mCompletion.mMode == eStfCompleteOnEquipment) {
+    mKnownEquipment[pEquipment] = lNow;
+  }
 
-        lReadoutMsgs.clear();
-        continue;
+  // the TF was already handed out (timed out, or other channels moved on): cannot be added anymore
+  if (std::int64_t(lStfId) <= mLastDispatchedStfId) {
+    if (mLateUpdates++ % 100 == 0) {
+      DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: update received after the TF was completed. Data is dropped. "
+        "stf_id={} input_channel={} total_occurrences={}", lStfId, pInputChannelIdx, mLateUpdates);
+    }
+    return;
+  }
+
+  auto &lChanState = mInputChannelStates[pInputChannelIdx];
+  lChanState.mStfId = lStfId;
+  lChanState.mLastUpdate = lNow;
+  lChanState.mSeenData = true;
+
+  // NOTE: the header HBFrame count is not reliable
+  const std::uint64_t lNumHbfs = pReadoutMsgs.empty() ? 0 : (pReadoutMsgs.size() - 1);
+
+  auto &lTask = mStfsInAssembly[lStfId];
+  lTask.mStfId = lStfId;
+  lTask.mLastUpdate = lNow;
+  lTask.mUpdates.push_back(std::move(pReadoutMsgs));
+
+  if (mCompletion.mMode == eStfCompleteOnEquipment) {
+    auto &lHbfs = lTask.mEquipmentHbfs[pEquipment];
+    const bool lWasComplete = (lHbfs >= mCompletion.mExpectedHbfs);
+    lHbfs += lNumHbfs;
+    if (!lWasComplete && (lHbfs >= mCompletion.mExpectedHbfs)) {
+      lTask.mCompleteEquipment++;
+    }
+  }
+
+  dispatchCompleteStfs();
+}
+
+/// All expected equipment delivered the HBFrames of the TF
+bool StfInputInterface::allEquipmentComplete(const StfBuildTask &pTask) const
+{
+  if (pTask.mCompleteEquipment < pTask.mEquipmentHbfs.size()) {
+    return false;
+  }
+
+  // configured number of equipment
+  if (mCompletion.mExpectedEquipment > 0) {
+    return pTask.mEquipmentHbfs.size() >= mCompletion.mExpectedEquipment;
+  }
+
+  // learned: equipment with updates within the wait time. The first TF completes on the next TF or on the timeout.
+  if (mLastDispatchedStfId < 0 || mKnownEquipment.empty()) {
+    return false;
+  }
+
+  for (const auto &lEquipment : mKnownEquipment) {
+    if (pTask.mEquipmentHbfs.count(lEquipment.first) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Hand out complete TFs in TF id order. Must be called with mStfAssemblyLock held.
+void StfInputInterface::dispatchCompleteStfs()
+{
+  const auto lNow = std::chrono::steady_clock::now();
+
+  // TFs before the oldest TF of the active channels are complete. Channels without recent data do not hold back TFs.
+  std::uint64_t lBoundary = std::numeric_limits<std::uint64_t>::max();
+  for (const auto &lChanState : mInputChannelStates) {
+    if (lChanState.mSeenData && (lNow - lChanState.mLastUpdate) < mCompletion.mTimeout) {
+      lBoundary = std::min(lBoundary, lChanState.mStfId);
+    }
+  }
+
+  // equipment that stopped sending is not expected anymore
+  for (auto lIt = mKnownEquipment.begin(); lIt != mKnownEquipment.end(); ) {
+    lIt = ((lNow - lIt->second) >= mCompletion.mTimeout) ? mKnownEquipment.erase(lIt) : std::next(lIt);
+  }
 
-      } else if (!mRunning) {
+  while (!mStfsInAssembly.empty()) {
+    auto lIt = mStfsInAssembly.begin();
+    auto &lTask = lIt->second;
+
+    // no updates for the wait time: finish the TF
+    lTask.mTimedOut = (lNow - lTask.mLastUpdate) >= mCompletion.mTimeout;
+
+    if (lTask.mStfId >= lBoundary && !lTask.mTimedOut) {
+      if (mCompletion.mMode != eStfCompleteOnEquipment || !allEquipmentComplete(lTask)) {
         break;
       }
+      mStfsCompleteOnEquipment++;
+    }
 
-      if (lReadoutMsgs.empty()) {
-        DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: empty readout multipart.");
-        continue;
-      }
+    mLastDispatchedStfId = std::max(mLastDispatchedStfId, std::int64_t(lTask.mStfId));
+    dispatchBuildTask(lTask);
+    mStfsInAssembly.erase(lIt);
+  }
+}
 
-      if (lReadoutMsgs.size() < 2) {
-        DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: no data sent, only header.");
-        continue;
-      }
+/// Hand the TF over to a builder worker
+void StfInputInterface::dispatchBuildTask(StfBuildTask &pTask)
+{
+  pTask.mDispatchSeq = mNextDispatchSeq++;
+  mBuilderInputQueues[mNextBuilder].push(std::move(pTask));
+  mNextBuilder = (mNextBuilder + 1) % mNumBuilders;
 
-      // Copy to avoid surprises. The receiving header is not O2 compatible and can be discarded
-      ReadoutSubTimeframeHeader lReadoutHdr;
-      assert(lReadoutMsgs[0]->GetSize() == sizeof(ReadoutSubTimeframeHeader));
-      std::memcpy(&lReadoutHdr, lReadoutMsgs[0]->GetData(), sizeof(ReadoutSubTimeframeHeader));
+  pTask = StfBuildTask();
+}
 
-      // log only
-      if (lReadoutHdr.mTimeFrameId % (100 + pIdx) == 0) {
-        static thread_local std::uint64_t sStfSeen = 0;
-        if (lReadoutHdr.mTimeFrameId != sStfSeen) {
-          sStfSeen = lReadoutHdr.mTimeFrameId;
-          DDLOGF(fair::Severity::DEBUG, "READOUT INTERFACE: Received an ReadoutMsg. stf_id={}", lReadoutHdr.mTimeFrameId);
-        }
-      }
+/// Take the next TF: own queue first, then steal the oldest task of another worker
+bool StfInputInterface::takeBuildTask(const std::size_t pIdx, StfBuildTask &pTask)
+{
+  // how long an idle worker waits on its own queue before looking for work again
+  static constexpr auto cStealInterval = std::chrono::milliseconds(10);
 
-      // check multipart size
-      {
-        if (lReadoutHdr.mNumberHbf != lReadoutMsgs.size() - 1) {
-          static thread_local std::uint64_t sNumMessages = 0;
-          if (sNumMessages++ % 8192 == 0) {
-            DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: wrong number of HBFrames in the header."
-              "header_cnt={} msg_length={} total_occurrences={}",
-              lReadoutHdr.mNumberHbf, (lReadoutMsgs.size() - 1), sNumMessages);
-          }
+  if (mBuilderInputQueues[pIdx].try_pop(pTask)) {
+    return true;
+  }
 
-          lReadoutHdr.mNumberHbf = lReadoutMsgs.size() - 1;
-        }
+  for (std::size_t i = 1; i < mNumBuilders; i++) {
+    if (mBuilderInputQueues[(pIdx + i) % mNumBuilders].try_pop(pTask)) {
+      mStolenTasks.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
 
-        if (lReadoutMsgs.size() > 1) {
-          try {
-            const auto R = RDHReader(lReadoutMsgs[1]);
-            const auto lLinkId = R.getLinkID();
-
-            if (lLinkId != lReadoutHdr.mLinkId) {
-              DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: update link ID does not match RDH in the data block."
-                " hdr_link_id={} rdh_link_id={}", lReadoutHdr.mLinkId, lLinkId);
-            }
-          } catch (RDHReaderException &e) {
-            DDLOGF(fair::Severity::ERROR, e.what());
-            // TODO: the whole ReadoutMsg is discarded. Account and report the data size.
-            continue;
-          }
-        }
+  return mBuilderInputQueues[pIdx].pop_wait_for(pTask, cStealInterval);
+}
+
+/// Queue the STF after all STFs handed out before it. Workers build TFs concurrently and can finish out of order.
+void StfInputInterface::queueInOrder(const std::uint64_t pDispatchSeq, std::unique_ptr<SubTimeFrame> &&pStf)
+{
+  std::scoped_lock lLock(mReorderLock);
+
+  mReorderStfs.emplace(pDispatchSeq, std::move(pStf));
+
+  // NOTE: queue under the lock, so the next STFs cannot overtake
+  while (!mReorderStfs.empty() && mReorderStfs.begin()->first == mNextOutputSeq) {
+    auto lStf = std::move(mReorderStfs.begin()->second);
+    mReorderStfs.erase(mReorderStfs.begin());
+    mNextOutputSeq++;
+
+    if (lStf) {
+      mDevice.queue(eStfBuilderOut, std::move(lStf));
+    }
+  }
+}
+
+/// StfBuilding thread
+void StfInputInterface::StfBuilderThread(const std::size_t pIdx)
+{
+  // keep building close to the header region
+  if (mDevice.numaNode() != NumaUtils::cNoNode) {
+    NumaUtils::pinThread(mDevice.numaNode());
+  }
+
+  assert (mBuilderInputQueues.size() == mNumBuilders);
+  assert (pIdx < mBuilderInputQueues.size());
+
+  // Stf builder
+  SubTimeFrameReadoutBuilder &lStfBuilder = mStfBuilders[pIdx];
+
+  using hres_clock = std::chrono::high_resolution_clock;
+  auto lStfStartTime = hres_clock::now();
+
+  StfBuildTask lTask;
+
+  while (mRunning) {
+
+    if (!takeBuildTask(pIdx, lTask)) {
+      continue;
+    }
+
+    // the whole TF is built by this worker
+    ReadoutDataUtils::sFirstSeenHBOrbitCnt = 0;
+
+    for (auto &lReadoutMsgs : lTask.mUpdates) {
+      addReadoutUpdate(lStfBuilder, lReadoutMsgs, pIdx);
+    }
+    lTask.mUpdates.clear();
+
+    std::unique_ptr<SubTimeFrame> lStf = lStfBuilder.getStf();
+    if (!lStf) {
+      queueInOrder(lTask.mDispatchSeq, nullptr);
+    } else {
+      // TFs from the orbit start on the TF boundary, even if the first HBFrames are missing
+      if (mBoundary.mMode == eStfBoundaryOrbit) {
+        lStf->setFirstOrbit(mBoundary.stfFirstOrbit(lStf->header().mId));
       }
 
-      if (lReadoutMsgs.size() <= 1) {
-        DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: no data sent, invalid blocks removed.");
-        continue;
+      if (lTask.mTimedOut) {
+        DDLOGF(fair::Severity::WARNING, "READOUT INTERFACE: finishing STF on a timeout. stf_id={} size={}",
+          lStf->header().mId, lStf->getDataSize());
       }
 
-      // DDLOG(fair::Severity::DEBUG) << "RECEIVED:: "
-      //           << "TF id: " << lReadoutHdr.mTimeFrameId << ", "
-      //           << "#HBF: " << lReadoutHdr.mNumberHbf << ", "
-      //           << "EQ: " << lReadoutHdr.linkId;
+      queueInOrder(lTask.mDispatchSeq, std::move(lStf));
 
-      // check for the new TF marker
-      if (lReadoutHdr.mTimeFrameId != lCurrentStfId) {
+      { // MON: data of a new STF received, get the freq and new start time
+        const auto lStfDur = std::chrono::duration_cast<std::chrono::microseconds>(hres_clock::now() - lStfStartTime);
+        mStfIntervalHist.Fill(lStfDur.count());
+        lStfStartTime = hres_clock::now();
+      }
+    }
+  }
 
-        if (lReadoutMsgs.size() > 1) {
-          ReadoutDataUtils::sFirstSeenHBOrbitCnt = 0;
-        }
+  DDLOGF(fair::Severity::trace, "Exiting StfBuilder thread...");
+}
 
-        if (lCurrentStfId >= 0) {
-          // Finished: queue the current STF and start a new one
-          std::unique_ptr<SubTimeFrame> lStf = lStfBuilder.getStf();
+/// Add one readout update to the STF being built
+void StfInputInterface::addReadoutUpdate(SubTimeFrameReadoutBuilder &pStfBuilder,
+  std::vector<FairMQMessagePtr> &pReadoutMsgs, const std::size_t pIdx)
+{
+  if (pReadoutMsgs.empty()) {
+    DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: empty readout multipart.");
+    return;
+  }
 
-          if (lStf) {
-            // DDLOG(fair::Severity::DEBUG) << "Received TF[" << lStf->header().mId<< "]::size= " << lStf->getDataSize();
-            mDevice.queue(eStfBuilderOut, std::move(lStf));
+  if (pReadoutMsgs.size() < 2) {
+    DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: no data sent, only header.");
+    return;
+  }
 
-            { // MON: data of a new STF received, get the freq and new start time
-              const auto lStfDur = std::chrono::duration<float>(hres_clock::now() - lStfStartTime);
-              mStfFreqSamples.Fill(1.0f / lStfDur.count() * mNumBuilders);
-              lStfStartTime = hres_clock::now();
-            }
-          }
-        }
+  // select the RDH version once for the whole update
+  try {
+    const auto &lMsg = pReadoutMsgs[1];
+    const auto lVer = ReadoutDataUtils::rdhVersion(reinterpret_cast<const char*>(lMsg->GetData()), lMsg->GetSize());
+    ReadoutDataUtils::dispatchRdhVersion(lVer, [&](auto pTag) {
+      addReadoutUpdateImpl<typename decltype(pTag)::type>(pStfBuilder, pReadoutMsgs, pIdx);
+    });
+  } catch (RDHReaderException &e) {
+    DDLOGF(fair::Severity::ERROR, e.what());
+    // TODO: the whole ReadoutMsg is discarded. Account and report the data size.
+  }
+}
 
-        // start a new STF
-        lCurrentStfId = lReadoutHdr.mTimeFrameId;
+template <typename RDH>
+void StfInputInterface::addReadoutUpdateImpl(SubTimeFrameReadoutBuilder &pStfBuilder,
+  std::vector<FairMQMessagePtr> &pReadoutMsgs, const std::size_t pIdx)
+{
+  // Copy to avoid surprises. The receiving header is not O2 compatible and can be discarded
+  ReadoutSubTimeframeHeader lReadoutHdr;
+  assert(pReadoutMsgs[0]->GetSize() == sizeof(ReadoutSubTimeframeHeader));
+  std::memcpy(&lReadoutHdr, pReadoutMsgs[0]->GetData(), sizeof(ReadoutSubTimeframeHeader));
+
+  // log only
+  if (lReadoutHdr.mTimeFrameId % (100 + pIdx) == 0) {
+    static thread_local std::uint64_t sStfSeen = 0;
+    if (lReadoutHdr.mTimeFrameId != sStfSeen) {
+      sStfSeen = lReadoutHdr.mTimeFrameId;
+      DDLOGF(fair::Severity::DEBUG, "READOUT INTERFACE: Received an ReadoutMsg. stf_id={}", lReadoutHdr.mTimeFrameId);
+    }
+  }
+
+  // check multipart size
+  {
+    if (lReadoutHdr.mNumberHbf != pReadoutMsgs.size() - 1) {
+      static thread_local std::uint64_t sNumMessages = 0;
+      if (sNumMessages++ % 8192 == 0) {
+        DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: wrong number of HBFrames in the header."
+          "header_cnt={} msg_length={} total_occurrences={}",
+          lReadoutHdr.mNumberHbf, (pReadoutMsgs.size() - 1), sNumMessages);
       }
 
-      // check subspecifications of all messages
-      header::DataHeader::SubSpecificationType lSubSpecification = ~header::DataHeader::SubSpecificationType(0);
-      header::DataOrigin lDataOrigin;
+      lReadoutHdr.mNumberHbf = pReadoutMsgs.size() - 1;
+    }
+
+    if (pReadoutMsgs.size() > 1) {
       try {
-        const auto R1 = RDHReader(lReadoutMsgs[1]);
-        lDataOrigin = ReadoutDataUtils::getDataOrigin(R1);
-        lSubSpecification = ReadoutDataUtils::getSubSpecification(R1);
+        const auto R = RDHReaderT<RDH>(pReadoutMsgs[1]);
+        const auto lLinkId = R.getLinkID();
+
+        if (lLinkId != lReadoutHdr.mLinkId) {
+          DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: update link ID does not match RDH in the data block."
+            " hdr_link_id={} rdh_link_id={}", lReadoutHdr.mLinkId, lLinkId);
+        }
       } catch (RDHReaderException &e) {
         DDLOGF(fair::Severity::ERROR, e.what());
         // TODO: the whole ReadoutMsg is discarded. Account and report the data size.
-        continue;
+        return;
       }
+    }
+  }
 
-      assert (lReadoutMsgs.size() > 1);
-      auto lStartHbf = lReadoutMsgs.begin() + 1; // skip the meta message
-      auto lEndHbf = lStartHbf + 1;
+  if (pReadoutMsgs.size() <= 1) {
+    DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: no data sent, invalid blocks removed.");
+    return;
+  }
 
-      std::size_t lAdded = 0;
-      bool lErrorWhileAdding = false;
+  // DDLOG(fair::Severity::DEBUG) << "RECEIVED:: "
+  //           << "TF id: " << lReadoutHdr.mTimeFrameId << ", "
+  //           << "#HBF: " << lReadoutHdr.mNumberHbf << ", "
+  //           << "EQ: " << lReadoutHdr.linkId;
 
-      while (1) {
-        if (lEndHbf == lReadoutMsgs.end()) {
-          //insert
-          lStfBuilder.addHbFrames(lDataOrigin, lSubSpecification, lReadoutHdr, lStartHbf, lEndHbf - lStartHbf);
-          lAdded += (lEndHbf - lStartHbf);
-          break;
-        }
+  // check subspecifications of all messages
+  header::DataHeader::SubSpecificationType lSubSpecification = ~header::DataHeader::SubSpecificationType(0);
+  header::DataOrigin lDataOrigin;
+  try {
+    const auto R1 = RDHReaderT<RDH>(pReadoutMsgs[1]);
+    lDataOrigin = ReadoutDataUtils::getDataOrigin(R1);
+    lSubSpecification = ReadoutDataUtils::getSubSpecification(R1);
+  } catch (RDHReaderException &e) {
+    DDLOGF(fair::Severity::ERROR, e.what());
+    // TODO: the whole ReadoutMsg is discarded. Account and report the data size.
+    return;
+  }
 
-        header::DataHeader::SubSpecificationType lNewSubSpec = ~header::DataHeader::SubSpecificationType(0);
-        try {
-          const auto Rend = RDHReader(*lEndHbf);
-          lNewSubSpec = ReadoutDataUtils::getSubSpecification(Rend);
-        } catch (RDHReaderException &e) {
-            DDLOGF(fair::Severity::ERROR, e.what());
-            // TODO: portion of the ReadoutMsg is discarded. Account and report the data size.
-            lErrorWhileAdding = true;
-            break;
-          }
+  assert (pReadoutMsgs.size() > 1);
+  auto lStartHbf = pReadoutMsgs.begin() + 1; // skip the meta message
+  auto lEndHbf = lStartHbf + 1;
 
-        if (lNewSubSpec != lSubSpecification) {
-          DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: update with mismatched subspecification."
-            " block[0]: {:#06x}, block[{}]: {:#06x}",
-            lSubSpecification, (lEndHbf - (lReadoutMsgs.begin() + 1)), lNewSubSpec);
-          // insert
-          lStfBuilder.addHbFrames(lDataOrigin, lSubSpecification, lReadoutHdr, lStartHbf, lEndHbf - lStartHbf);
-          lAdded += (lEndHbf - lStartHbf);
-          lStartHbf = lEndHbf;
+  std::size_t lAdded = 0;
+  bool lErrorWhileAdding = false;
 
-          lSubSpecification = lNewSubSpec;
-        }
-        lEndHbf = lEndHbf + 1;
-      }
+  while (1) {
+    if (lEndHbf == pReadoutMsgs.end()) {
+      //insert
+      pStfBuilder.addHbFrames<RDH>(lDataOrigin, lSubSpecification, lReadoutHdr, lStartHbf, lEndHbf - lStartHbf);
+      lAdded += (lEndHbf - lStartHbf);
+      break;
+    }
 
-      if (!lErrorWhileAdding && (lAdded != lReadoutMsgs.size() - 1) ) {
-        DDLOGF(fair::Severity::ERROR, "BUG: Not all received HBFrames added to the STF...");
+    header::DataHeader::SubSpecificationType lNewSubSpec = ~header::DataHeader::SubSpecificationType(0);
+    try {
+      const auto Rend = RDHReaderT<RDH>(*lEndHbf);
+      lNewSubSpec = ReadoutDataUtils::getSubSpecification(Rend);
+    } catch (RDHReaderException &e) {
+        DDLOGF(fair::Severity::ERROR, e.what());
+        // TODO: portion of the ReadoutMsg is discarded. Account and report the data size.
+        lErrorWhileAdding = true;
+        break;
       }
+
+    if (lNewSubSpec != lSubSpecification) {
+      DDLOGF(fair::Severity::ERROR, "READOUT INTERFACE: update with mismatched subspecification."
+        " block[0]: {:#06x}, block[{}]: {:#06x}",
+        lSubSpecification, (lEndHbf - (pReadoutMsgs.begin() + 1)), lNewSubSpec);
+      // insert
+      pStfBuilder.addHbFrames<RDH>(lDataOrigin, lSubSpecification, lReadoutHdr, lStartHbf, lEndHbf - lStartHbf);
+      lAdded += (lEndHbf - lStartHbf);
+      lStartHbf = lEndHbf;
+
+      lSubSpecification = lNewSubSpec;
     }
+    lEndHbf = lEndHbf + 1;
+  }
 
-  DDLOGF(fair::Severity::trace, "Exiting StfBuilder thread...");
+  if (!lErrorWhileAdding && (lAdded != pReadoutMsgs.size() - 1) ) {
+    DDLOGF(fair::Severity::ERROR, "BUG: Not all received HBFrames added to the STF...");
+  }
 }
 
 }
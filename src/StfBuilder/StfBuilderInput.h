@@ -15,6 +15,7 @@
 #define ALICEO2_STFBUILDER_INPUT_H_
 
 #include <SubTimeFrameBuilder.h>
+#include <ReadoutDataModel.h>
 #include <ConcurrentQueue.h>
 #include <Utilities.h>
 
@@ -22,6 +23,9 @@
 
 #include <thread>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
 
 namespace o2
 {
@@ -30,40 +34,147 @@ namespace DataDistribution
 
 class StfBuilderDevice;
 
+/// How the input decides that all data of a TF was received
+enum StfCompletionMode {
+  eStfCompleteOnNextTf,    // when all input channels moved on to a later TF
+  eStfCompleteOnEquipment  // when all expected equipment delivered its HBFrames
+};
+
+struct StfCompletionConfig {
+  StfCompletionMode mMode = eStfCompleteOnNextTf;
+  std::size_t mExpectedEquipment = 0; // 0: learned from the previous TF
+  std::size_t mExpectedHbfs = 0;      // HBFrames per equipment and TF. 0: HBFrames in a TF (mHbfsPerTf)
+  std::chrono::milliseconds mTimeout = std::chrono::seconds(2); // fallback
+};
+
+/// How the TF id of the readout data is determined
+enum StfBoundaryMode {
+  eStfBoundaryReadoutId, // TF id sent by readout
+  eStfBoundaryOrbit      // TF id computed from the RDH orbit: aligned on all FLPs
+};
+
+struct StfBoundaryConfig {
+  StfBoundaryMode mMode = eStfBoundaryReadoutId;
+  std::uint32_t mHbfsPerTf = 256;  // orbits in a TF
+  std::uint32_t mFirstOrbit = 0;   // orbit of the first TF
+
+  std::uint32_t stfId(const std::uint32_t pOrbit) const { return (pOrbit - mFirstOrbit) / mHbfsPerTf; }
+  std::uint32_t stfFirstOrbit(const std::uint32_t pStfId) const { return mFirstOrbit + pStfId * mHbfsPerTf; }
+};
+
 class StfInputInterface
 {
  public:
   StfInputInterface() = delete;
   StfInputInterface(StfBuilderDevice& pStfBuilderDev)
-    : mDevice(pStfBuilderDev),
-      mStfFreqSamples()
+    : mDevice(pStfBuilderDev)
   {
   }
 
-  void start(const std::size_t pNumBuilders);
+  void start(const std::size_t pNumBuilders, const StfCompletionConfig &pCompletion = StfCompletionConfig(),
+    const StfBoundaryConfig &pBoundary = StfBoundaryConfig());
   void stop();
 
   void DataHandlerThread(const unsigned pInputChannelIdx);
   void StfBuilderThread(const std::size_t pIdx);
 
-  const RunningSamples<float>& StfFreqSamples() const { return mStfFreqSamples; }
+  std::size_t numBuilders() const { return mNumBuilders; }
+  std::uint64_t stolenTaskCount() const { return mStolenTasks; }
+
+  /// STF build intervals [us], recorded by all builder threads
+  PercentileHistogram<>& StfIntervalHistogram() { return mStfIntervalHist; }
+
+  std::uint64_t headerFallbackCount() const {
+    auto lHeaderPool = std::atomic_load(&mHeaderPool);
+    return lHeaderPool ? lHeaderPool->fallbackCount() : 0;
+  }
+
+  void regionStats(std::vector<RegionStats> &pStats) const {
+    auto lHeaderPool = std::atomic_load(&mHeaderPool);
+    if (lHeaderPool) {
+      pStats.push_back(lHeaderPool->stats());
+    }
+  }
  private:
   /// Main SubTimeBuilder O2 device
   StfBuilderDevice& mDevice;
 
-  /// Thread for the input channel
+  /// Threads for the input channel: one per sub-channel (socket)
   std::atomic_bool mRunning = false;
-  std::thread mInputThread;
-
-  RunningSamples<float> mStfFreqSamples;
-
-
-  /// StfBuilding threads
-  /// Start a thread per building slot: updates are distributed with % numBuildingThreads
+  std::vector<std::thread> mInputThreads;
+
+  PercentileHistogram<> mStfIntervalHist;
+
+  /// All readout updates of one TF. A TF is built by a single worker, preserving the update order.
+  struct StfBuildTask {
+    std::uint64_t mStfId = 0;
+    std::uint64_t mDispatchSeq = 0; // order of the hand out (TF id order)
+    bool mTimedOut = false; // no new TF started within the wait time
+    std::chrono::steady_clock::time_point mLastUpdate;
+    std::vector<std::vector<FairMQMessagePtr>> mUpdates;
+
+    // equipment accounting: received HBFrames per equipment (subspecification)
+    std::map<header::DataHeader::SubSpecificationType, std::uint64_t> mEquipmentHbfs;
+    std::size_t mCompleteEquipment = 0;
+  };
+
+  /// TF assembly from all input sub-channels
+  /// A TF is complete when every active sub-channel has moved on to a later TF, or when it did not
+  /// receive updates for the wait time. Complete TFs are handed to the builders in TF id order.
+  struct InputChannelState {
+    std::uint64_t mStfId = 0;
+    std::chrono::steady_clock::time_point mLastUpdate;
+    bool mSeenData = false;
+  };
+
+  void assembleStfUpdate(const unsigned pInputChannelIdx, const ReadoutSubTimeframeHeader &pReadoutHdr,
+    const header::DataHeader::SubSpecificationType pEquipment, std::vector<FairMQMessagePtr> &&pReadoutMsgs);
+  void dispatchCompleteStfs();
+  bool allEquipmentComplete(const StfBuildTask &pTask) const;
+  void assembleOrbitStfUpdates(FairMQChannel &pInputChan, const unsigned pInputChannelIdx,
+    ReadoutSubTimeframeHeader &pReadoutHdr, std::vector<FairMQMessagePtr> &&pReadoutMsgs);
+  template <typename RDH>
+  void assembleOrbitStfUpdatesImpl(FairMQChannel &pInputChan, const unsigned pInputChannelIdx,
+    ReadoutSubTimeframeHeader &pReadoutHdr, std::vector<FairMQMessagePtr> &&pReadoutMsgs);
+  header::DataHeader::SubSpecificationType updateEquipment(const std::vector<FairMQMessagePtr> &pReadoutMsgs) const;
+
+  StfCompletionConfig mCompletion;
+  StfBoundaryConfig mBoundary;
+
+  std::mutex mStfAssemblyLock;
+  std::map<std::uint64_t, StfBuildTask> mStfsInAssembly;
+  std::vector<InputChannelState> mInputChannelStates;
+  std::int64_t mLastDispatchedStfId = -1;
+  std::uint64_t mLateUpdates = 0;
+  // equipment with updates within the wait time, with the time of its last update
+  std::map<header::DataHeader::SubSpecificationType, std::chrono::steady_clock::time_point> mKnownEquipment;
+  std::uint64_t mStfsCompleteOnEquipment = 0;
+
+  void dispatchBuildTask(StfBuildTask &pTask);
+  bool takeBuildTask(const std::size_t pIdx, StfBuildTask &pTask);
+  void queueInOrder(const std::uint64_t pDispatchSeq, std::unique_ptr<SubTimeFrame> &&pStf);
+  void addReadoutUpdate(SubTimeFrameReadoutBuilder &pStfBuilder, std::vector<FairMQMessagePtr> &pReadoutMsgs,
+    const std::size_t pIdx);
+  template <typename RDH>
+  void addReadoutUpdateImpl(SubTimeFrameReadoutBuilder &pStfBuilder, std::vector<FairMQMessagePtr> &pReadoutMsgs,
+    const std::size_t pIdx);
+
+  /// StfBuilding worker pool
+  /// The input threads hand out complete TFs round-robin to the worker queues. Idle workers steal
+  /// the oldest task from the other queues. Built STFs are put back in the hand out order before the output.
   std::size_t mNumBuilders = 1;
-  std::vector<ConcurrentFifo<std::vector<FairMQMessagePtr>>> mBuilderInputQueues;
+  std::size_t mNextBuilder = 0;
+  std::uint64_t mNextDispatchSeq = 0; // guarded by mStfAssemblyLock
+  std::atomic_uint64_t mStolenTasks = 0;
+  std::shared_ptr<FMQUnsynchronizedPoolMemoryResource> mHeaderPool;
+  std::vector<ConcurrentFifo<StfBuildTask>> mBuilderInputQueues;
   std::vector<SubTimeFrameReadoutBuilder> mStfBuilders;
   std::vector<std::thread> mBuilderThreads;
+
+  // STFs built ahead of an earlier TF, by hand out order. A null STF only advances the order.
+  std::mutex mReorderLock;
+  std::uint64_t mNextOutputSeq = 0;
+  std::map<std::uint64_t, std::unique_ptr<SubTimeFrame>> mReorderStfs;
 };
 
 }
@@ -45,6 +45,26 @@ void addCustomOptions(bpo::options_description& options)
       bpo::value<std::int64_t>()->default_value(-1),
       "Maximum number of buffered SubTimeFrames before starting to drop data (unlimited: -1)."
     )
+    (
+      o2::DataDistribution::StfBuilderDevice::OptionKeyNumaNode,
+      bpo::value<int>()->default_value(-1),
+      "NUMA node for memory regions and SubTimeFrame building threads (no placement: -1)."
+    )
+    (
+      o2::DataDistribution::StfBuilderDevice::OptionKeyOutputQueueMaxStfs,
+      bpo::value<std::uint64_t>()->default_value(0),
+      "Maximum number of SubTimeFrames queued for sending, and for the file sink (unlimited: 0)."
+    )
+    (
+      o2::DataDistribution::StfBuilderDevice::OptionKeyOutputQueueMaxSize,
+      bpo::value<std::uint64_t>()->default_value(0),
+      "Maximum size of SubTimeFrames queued for sending, and for the file sink (in MiB, unlimited: 0)."
+    )
+    (
+      o2::DataDistribution::StfBuilderDevice::OptionKeyOutputQueuePolicy,
+      bpo::value<std::string>()->default_value("block"),
+      "Action when an output queue limit is reached. Allowed are: block, drop-oldest, drop-newest."
+    )
     (
       o2::DataDistribution::StfBuilderDevice::OptionKeyOutputChannelName,
       bpo::value<std::string>()->default_value("builder-stf-channel"),
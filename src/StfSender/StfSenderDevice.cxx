@@ -183,13 +183,13 @@ void StfSenderDevice::StfReceiverThread()
     }
 
     { // Input STF frequency
-      const auto lStfDur = std::chrono::duration<float>(hres_clock::now() - lStfStartTime);
-      mStfFreqSamples.Fill(1.0f / lStfDur.count());
+      const auto lStfDur = std::chrono::duration_cast<std::chrono::microseconds>(hres_clock::now() - lStfStartTime);
+      mStfIntervalHist.Fill(lStfDur.count());
       lStfStartTime = hres_clock::now();
     }
 
     // get data size
-    mStfSizeSamples.Fill(lStf->getDataSize());
+    mStfSizeHist.Fill(lStf->getDataSize());
 
     { // rate-limited LOG: print stats every 100 TFs
       static unsigned long floodgate = 0;
@@ -215,8 +215,17 @@ void StfSenderDevice::InfoThread()
 
     // DDLOGF(fair::Severity::INFO, "StfSender queued_stfs={}", this->getPipelineSize());
 
-    DDLOGF(fair::Severity::info, "SubTimeFrame size_mean={} in_frequency_mean={} queued_stf={}",
-      mStfSizeSamples.Mean(), mStfFreqSamples.Mean(), mNumStfs);
+    {
+      const auto lSize = mStfSizeHist.Window();
+      const auto lInterval = mStfIntervalHist.Window();
+
+      DDLOGF(fair::Severity::info, "SubTimeFrame size_mean={} size_p50={} size_p99={} size_p999={} "
+        "in_rate={:.2f} in_interval_us_p99={} queued_stf={}",
+        lSize.Mean(), lSize.Quantile(0.5), lSize.Quantile(0.99), lSize.Quantile(0.999),
+        lInterval.Rate(), lInterval.Quantile(0.99), mNumStfs);
+    }
+
+    logPipelineStats({ "file_sink", "send" });
 
     std::this_thread::sleep_for(2s);
   }
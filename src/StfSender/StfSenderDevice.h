@@ -81,6 +81,11 @@ class StfSenderDevice : public DataDistDevice,
 
   void StfReceiverThread();
 
+  std::size_t getPipelineElementSize(const std::unique_ptr<SubTimeFrame> &pStf) const final
+  {
+    return pStf ? pStf->getDataSize() : 0;
+  }
+
   unsigned getNextPipelineStage(unsigned pStage) final
   {
     StfSenderPipeline lNextStage = eInvalidStage;
@@ -173,8 +178,8 @@ class StfSenderDevice : public DataDistDevice,
   /// Info thread
   void InfoThread();
   std::thread mInfoThread;
-  RunningSamples<uint64_t> mStfSizeSamples;
-  RunningSamples<float> mStfFreqSamples;
+  PercentileHistogram<> mStfSizeHist;     // bytes
+  PercentileHistogram<> mStfIntervalHist; // us
 };
 }
 } /* namespace o2::DataDistribution */
@@ -34,8 +34,8 @@ TfBuilderDevice::TfBuilderDevice()
     IFifoPipeline(eTfPipelineSize),
     mFileSink(*this, *this, eTfFileSinkIn, eTfFileSinkOut),
     mFileSource(*this, eTfFileSourceOut),
-    mTfSizeSamples(),
-    mTfFreqSamples()
+    mTfSizeHist(),
+    mTfIntervalHist()
 {
 }
 
@@ -53,6 +53,25 @@ void TfBuilderDevice::InitTask()
     mStandalone = GetConfig()->GetValue<bool>(OptionKeyStandalone);
     mTfBufferSize = GetConfig()->GetValue<std::uint64_t>(OptionKeyTfMemorySize);
     mTfBufferSize <<= 20; /* input parameter is in MiB */
+    mTfHdrBufferSize = GetConfig()->GetValue<std::uint64_t>(OptionKeyTfHeaderMemorySize);
+    mTfHdrBufferSize <<= 20; /* input parameter is in MiB */
+
+    // auto sizing: headers are small compared to the data they describe
+    if (mTfHdrBufferSize == 0) {
+      mTfHdrBufferSize = std::max(std::uint64_t(16) << 20, ((mTfBufferSize / 32) >> 20) << 20);
+    }
+    DDLOGF(fair::Severity::INFO, "Configuration: TimeFrame header memory size is {} MiB", mTfHdrBufferSize >> 20);
+    mNumaNode = GetConfig()->GetValue<int>(OptionKeyNumaNode);
+
+    if (mNumaNode != NumaUtils::cNoNode) {
+      if (!NumaUtils::nodeValid(mNumaNode)) {
+        DDLOGF(fair::Severity::ERROR, "Configuration: NUMA node does not exist. numa_node={}", mNumaNode);
+        throw "NUMA node option";
+        return;
+      }
+      DDLOGF(fair::Severity::INFO, "Configuration: TimeFrame memory and input threads are placed on NUMA node {}",
+        mNumaNode);
+    }
 
     mDiscoveryConfig = std::make_shared<ConsulTfBuilder>(ProcessType::TfBuilder,
       Config::getEndpointOption(*GetConfig()));
@@ -150,7 +169,8 @@ bool TfBuilderDevice::start()
 
   if (!mStandalone && dplEnabled()) {
     auto& lOutputChan = GetChannel(getDplChannelName(), 0);
-    mTfBuilder = std::make_unique<TimeFrameBuilder>(lOutputChan, mTfBufferSize, dplEnabled());
+    mTfBuilder = std::make_unique<TimeFrameBuilder>(lOutputChan, mTfBufferSize, mTfHdrBufferSize, dplEnabled(),
+      mNumaNode);
     mTfDplAdapter = std::make_unique<StfToDplAdapter>(lOutputChan);
   }
 
@@ -169,9 +189,9 @@ bool TfBuilderDevice::start()
 
   // start file source
   if (mStandalone) {
-    mFileSource.start(*mStandaloneChannel, false);
+    mFileSource.start(*mStandaloneChannel, false, mNumaNode);
   } else {
-    mFileSource.start(GetChannel(mDplChannelName), mDplEnabled);
+    mFileSource.start(GetChannel(mDplChannelName), mDplEnabled, mNumaNode);
   }
 
   return true;
@@ -236,9 +256,16 @@ bool TfBuilderDevice::ConditionalRun()
 
 void TfBuilderDevice::TfForwardThread()
 {
+  // headers are adapted in the TimeFrame region
+  if (mNumaNode != NumaUtils::cNoNode) {
+    NumaUtils::pinThread(mNumaNode);
+  }
+
+  StageBatch lFwdInput(*this, eTfFwdIn);
+
   auto lFreqStartTime = std::chrono::high_resolution_clock::now();
   while (mRunning) {
-    std::unique_ptr<SubTimeFrame> lTf = dequeue(eTfFwdIn);
+    std::unique_ptr<SubTimeFrame> lTf = lFwdInput.next();
     if (!lTf) {
       DDLOG(fair::Severity::WARNING) << "TfForwardThread(): Exiting... ";
       break;
@@ -248,15 +275,15 @@ void TfBuilderDevice::TfForwardThread()
 
     // MON: record frequency and size of TFs
     {
-      mTfFreqSamples.Fill(
-        1.0 / std::chrono::duration<double>(
-                std::chrono::high_resolution_clock::now() - lFreqStartTime)
-                .count());
+      mTfIntervalHist.Fill(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::high_resolution_clock::now() - lFreqStartTime)
+          .count());
 
       lFreqStartTime = std::chrono::high_resolution_clock::now();
 
       // size samples
-      mTfSizeSamples.Fill(lTf->getDataSize());
+      mTfSizeHist.Fill(lTf->getDataSize());
     }
 
     if (!mStandalone) {
@@ -309,10 +336,35 @@ void TfBuilderDevice::InfoThread()
 
   while (IsRunningState()) {
 
-    DDLOG(fair::Severity::INFO) << "Mean size of TimeFrames : " << mTfSizeSamples.Mean();
-    DDLOG(fair::Severity::INFO) << "Mean TimeFrame frequency: " << mTfFreqSamples.Mean();
+    {
+      const auto lSize = mTfSizeHist.Window();
+      const auto lInterval = mTfIntervalHist.Window();
+
+      DDLOGF(fair::Severity::INFO, "TimeFrame size_mean={} size_p50={} size_p99={} size_p999={} "
+        "rate={:.2f} interval_us_p99={}",
+        lSize.Mean(), lSize.Quantile(0.5), lSize.Quantile(0.99), lSize.Quantile(0.999),
+        lInterval.Rate(), lInterval.Quantile(0.99));
+    }
     DDLOG(fair::Severity::INFO) << "Number of queued TFs    : " << getPipelineSize(); // current value
 
+    logPipelineStats({ "file_sink", "forward" });
+
+    const auto lHdrFallbacks = (mTfBuilder ? mTfBuilder->headerFallbackCount() : 0) +
+      mFileSource.headerFallbackCount();
+    if (lHdrFallbacks > 0) {
+      DDLOGF(fair::Severity::WARNING, "Header memory exhausted, headers allocated from the global SHM segment. "
+        "fallback_allocations={} header_memory_size={}", lHdrFallbacks, mTfHdrBufferSize);
+    }
+
+    std::vector<RegionStats> lRegionStats;
+    if (mTfBuilder) {
+      mTfBuilder->regionStats(lRegionStats);
+    }
+    mFileSource.regionStats(lRegionStats);
+    for (const auto &lStats : lRegionStats) {
+      logRegionStats(lStats);
+    }
+
     std::this_thread::sleep_for(2s);
   }
 
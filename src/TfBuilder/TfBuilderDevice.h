@@ -24,6 +24,7 @@
 #include <SubTimeFrameFileSource.h>
 #include <ConcurrentQueue.h>
 #include <Utilities.h>
+#include <NumaUtils.h>
 
 #include <deque>
 #include <mutex>
@@ -58,6 +59,8 @@ class TfBuilderDevice : public DataDistDevice,
  public:
   static constexpr const char* OptionKeyStandalone = "stand-alone";
   static constexpr const char* OptionKeyTfMemorySize = "tf-memory-size";
+  static constexpr const char* OptionKeyTfHeaderMemorySize = "tf-header-memory-size";
+  static constexpr const char* OptionKeyNumaNode = "numa-node";
 
   static constexpr const char* OptionKeyDplChannelName = "dpl-channel-name";
 
@@ -73,11 +76,18 @@ class TfBuilderDevice : public DataDistDevice,
   void InitTask() final;
   void ResetTask() final;
 
+  int numaNode() const noexcept { return mNumaNode; }
+
 
  protected:
   void PreRun() final;
   bool ConditionalRun() final;
 
+  std::size_t getPipelineElementSize(const std::unique_ptr<SubTimeFrame> &pStf) const final
+  {
+    return pStf ? pStf->getDataSize() : 0;
+  }
+
   // Run the TFBuilder pipeline
   unsigned getNextPipelineStage(unsigned pStage) final
   {
@@ -117,6 +127,8 @@ class TfBuilderDevice : public DataDistDevice,
   std::string mDplChannelName;
   bool mStandalone;
   std::uint64_t mTfBufferSize;
+  std::uint64_t mTfHdrBufferSize;
+  int mNumaNode = NumaUtils::cNoNode;
   std::string mPartitionId;
   bool mDplEnabled = false;
 
@@ -147,8 +159,8 @@ class TfBuilderDevice : public DataDistDevice,
   void InfoThread();
   std::thread mInfoThread;
 
-  RunningSamples<uint64_t> mTfSizeSamples;
-  RunningSamples<float> mTfFreqSamples;
+  PercentileHistogram<> mTfSizeHist;     // bytes
+  PercentileHistogram<> mTfIntervalHist; // us
 
   std::atomic_bool mRunning = false;
   std::atomic_bool mShouldExit = false;
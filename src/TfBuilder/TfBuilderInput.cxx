@@ -233,6 +233,10 @@ void TfBuilderInput::DataHandlerThread(const std::uint32_t pFlpIndex)
 
   DDLOGF(fair::Severity::TRACE, "Starting receiver thread for StfSender[{}]", pFlpIndex);
 
+  if (mDevice.numaNode() != NumaUtils::cNoNode) {
+    NumaUtils::pinThread(mDevice.numaNode());
+  }
+
   // Reference to the input channel
   auto& lInputChan = *mStfSenderChannels[pFlpIndex];
 
@@ -33,7 +33,13 @@ void addCustomOptions(bpo::options_description& options)
     "Standalone operation. TimeFrames will not be forwarded to other processes.")(
     o2::DataDistribution::TfBuilderDevice::OptionKeyTfMemorySize,
     bpo::value<std::uint64_t>()->default_value(512),
-    "Memory buffer reserved for building and buffering TimeFrames (in MiB).");
+    "Memory buffer reserved for building and buffering TimeFrames (in MiB).")(
+    o2::DataDistribution::TfBuilderDevice::OptionKeyTfHeaderMemorySize,
+    bpo::value<std::uint64_t>()->default_value(256),
+    "Memory buffer reserved for TimeFrame O2 headers (in MiB). Auto sizing: 0")(
+    o2::DataDistribution::TfBuilderDevice::OptionKeyNumaNode,
+    bpo::value<int>()->default_value(-1),
+    "NUMA node for the TimeFrame memory and the input threads (no placement: -1).");
 
   bpo::options_description lTfBuilderDplOptions("TfBuilder DPL options", 120);
   lTfBuilderDplOptions.add_options()
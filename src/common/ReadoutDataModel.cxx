@@ -21,6 +21,7 @@
 #include <Headers/DAQID.h>
 
 #include <tuple>
+#include <cstring>
 
 namespace o2
 {
@@ -69,34 +70,114 @@ ReadoutDataUtils::getSubSpecification(const RDHReader &R)
 std::tuple<std::size_t, bool>
 ReadoutDataUtils::getHBFrameMemorySize(const FairMQMessagePtr &pMsg)
 {
-  std::size_t lMemRet = 0;
-  bool lStopRet = false;
-
   try {
-    auto R = RDHReader(pMsg);
-    while (R != R.end()) {
-      lMemRet += R.getMemorySize();
-      lStopRet = R.getStopBit();
+    const auto lSummary = scanHBFrame(reinterpret_cast<const char*>(pMsg->GetData()), pMsg->GetSize());
 
-      R = R.next();
+    if (lSummary.mStatus == RDHFrameSummary::eStopMemorySize) {
+      DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: StopBit lookup failed: advanced beyond end of the buffer.");
+      return {lSummary.mMemorySize, false};
     }
+    return {lSummary.mMemorySize, lSummary.mStopBit};
   } catch (RDHReaderException &e) {
     DDLOGF(fair::Severity::ERROR, e.what());
   }
 
-  if (lMemRet > pMsg->GetSize()) {
-    DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: StopBit lookup failed: advanced beyond end of the buffer.");
-    lStopRet = false;
+  return {0, false};
+}
+
+template <typename RDH>
+RDHFrameSummary ReadoutDataUtils::scanHBFrame(const char* pData, const std::size_t pLen)
+{
+  RDHFrameSummary lSummary;
+  lSummary.mRdhSize = sizeof(RDH);
+
+  std::size_t lOffset = 0;
+
+  while (true) {
+    const std::size_t lDataLen = pLen - lOffset;
+
+    if (!pData || lDataLen < sizeof(RDH)) {
+      lSummary.mStatus = RDHFrameSummary::eShortData;
+      lSummary.mErrorOffset = lOffset;
+      break;
+    }
+
+    const auto R = RDHReaderT<RDH>(pData + lOffset, lDataLen);
+    const auto lSubSpec = getSubSpecification(R);
+    const auto lMemSize = R.getMemorySize();
+    const auto lOffsetNext = R.getOffsetToNext();
+    const auto lStopBit = R.getStopBit();
+
+    lSummary.mNumPages += 1;
+    lSummary.mNumEmptyPages += (lMemSize == sizeof(RDH)) ? 1 : 0;
+    lSummary.mMemorySize += lMemSize;
+    lSummary.mStopBit = lStopBit;
+
+    if (lSummary.mNumPages == 1) {
+      lSummary.mSubSpec = lSubSpec;
+      lSummary.mFeeId = R.getFeeID();
+      lSummary.mLinkId = R.getLinkID();
+      lSummary.mOrbit = R.getOrbit();
+      lSummary.mBC = R.getBC();
+      lSummary.mTriggerType = R.getTriggerType();
+    } else if (lSubSpec != lSummary.mSubSpec) {
+      lSummary.mStatus = RDHFrameSummary::eSubSpecMismatch;
+    }
+
+    // check if last package
+    if (lSummary.mStatus == RDHFrameSummary::eOk && lStopBit) {
+      if (lMemSize > lDataLen) {
+        lSummary.mStatus = RDHFrameSummary::eStopMemorySize;
+      } else {
+        // the last page ends at the next RDH offset for padded pages, or after its memory size for compact pages.
+        // When more data follows (coalesced HBFrames), take the end where the next RDH starts.
+        const auto lRdhAt = [&](const std::size_t pOff) {
+          return (pOff == pLen) || (pOff + sizeof(RDH) <= pLen && std::memcmp(pData + pOff, pData, 2) == 0);
+        };
+        const bool lNextFits = (lOffsetNext > 0 && lOffsetNext <= lDataLen);
+
+        if (lNextFits && lRdhAt(lOffset + lOffsetNext)) {
+          lSummary.mSize = lOffset + lOffsetNext;
+        } else if (lRdhAt(lOffset + lMemSize)) {
+          lSummary.mSize = lOffset + lMemSize;
+        } else {
+          lSummary.mSize = lOffset + (lNextFits ? lOffsetNext : lMemSize);
+        }
+        break; // all memory is accounted for
+      }
+    } else if (lSummary.mStatus == RDHFrameSummary::eOk) {
+      if (lOffsetNext == 0) {
+        lSummary.mStatus = RDHFrameSummary::eZeroOffset;
+      } else if (lOffsetNext >= lDataLen) {
+        lSummary.mStatus = RDHFrameSummary::eOffsetBeyondEnd;
+      } else if (lMemSize >= lDataLen) {
+        lSummary.mStatus = RDHFrameSummary::eMemorySizeBeyondEnd;
+      }
+    }
+
+    if (lSummary.mStatus != RDHFrameSummary::eOk) {
+      lSummary.mErrorOffset = lOffset;
+      lSummary.mErrorMemorySize = lMemSize;
+      lSummary.mErrorSubSpec = lSubSpec;
+      break;
+    }
+
+    lOffset += lOffsetNext;
   }
 
-  return {lMemRet, lStopRet};
+  return lSummary;
 }
 
-bool ReadoutDataUtils::rdhSanityCheck(const char* pData, const std::size_t pLen)
+RDHFrameSummary ReadoutDataUtils::scanHBFrame(const char* pData, const std::size_t pLen)
 {
-  const auto R = RDHReader(pData, pLen);
+  return dispatchRdhVersion(rdhVersion(pData, pLen), [&](auto pTag) {
+    return scanHBFrame<typename decltype(pTag)::type>(pData, pLen);
+  });
+}
 
-  if (pLen < R.getRDHSize()) { // size of one RDH
+bool ReadoutDataUtils::rdhSanityCheck(const RDHFrameSummary &pSummary, const char* pData, const std::size_t pLen)
+{
+  if (pSummary.mNumPages == 0) { // shorter than one RDH
     DDLOGF(fair::Severity::ERROR, "Data block is shorter than RDH: {}", pLen);
     o2::header::hexDump("Short readout block", pData, pLen);
     return false;
@@ -104,8 +185,7 @@ bool ReadoutDataUtils::rdhSanityCheck(const char* pData, const std::size_t pLen)
 
   // set first hbframe orbit if not set for this stf
   {
-    std::uint32_t lOrbit = 0;
-    std::memcpy(&lOrbit, pData + (5 * sizeof (std::uint32_t)), sizeof (std::uint32_t));
+    const std::uint32_t lOrbit = pSummary.mOrbit;
     if (sFirstSeenHBOrbitCnt == 0) {
       sFirstSeenHBOrbitCnt = lOrbit;
     } else {
@@ -117,146 +197,121 @@ bool ReadoutDataUtils::rdhSanityCheck(const char* pData, const std::size_t pLen)
     }
   }
 
-  // sub spec of first RDH
-  const auto lSubSpec = getSubSpecification(R);
-
-  std::int64_t lDataLen = pLen;
-  const char* lCurrData = pData;
-  std::uint32_t lPacketCnt = 1;
-
-  while(lDataLen > 0) {
-    const auto Rc = RDHReader(lCurrData, lDataLen);
+  const auto lDataLen = pLen - pSummary.mErrorOffset;
 
-    if (lDataLen > 0 && lDataLen < 64/*RDH*/ ) {
-      DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: Data is shorter than RDH. Block offset: {}", (lCurrData - pData));
-      o2::header::hexDump("Data at the end of the block", lCurrData, lDataLen);
-      return false;
-    }
-
-    // check if sub spec matches
-    if (lSubSpec != getSubSpecification(Rc)) {
+  switch (pSummary.mStatus) {
+    case RDHFrameSummary::eOk:
+      return true;
+    case RDHFrameSummary::eShortData:
+      DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: Data is shorter than RDH. Block offset: {}", pSummary.mErrorOffset);
+      o2::header::hexDump("Data at the end of the block", pData + pSummary.mErrorOffset, lDataLen);
+      break;
+    case RDHFrameSummary::eSubSpecMismatch:
       DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: Data sub-specification of trailing RDHs does not match."
         " RDH[0]::SubSpec: {:#06x}, RDH[{}]::SubSpec: {:#06x}",
-        lSubSpec, lPacketCnt, getSubSpecification(Rc));
-      return false;
-    }
-
-    const auto lMemSize = Rc.getMemorySize();
-    const auto lOffsetNext = Rc.getOffsetToNext();
-    const auto lStopBit = Rc.getStopBit();
-
-    // check if last package
-    if (lStopBit) {
-      if (lMemSize <= lDataLen) {
-        return true; // all memory is accounted for
-      } else {
-        DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: RDH has bit stop set, but memory size is different from remaining block size."
-          " memory_size={} remaining_buffer_size={}", lMemSize, lDataLen);
-        return false;
-      }
-    }
-
-    if (lOffsetNext == 0) {
+        pSummary.mSubSpec, pSummary.mNumPages, pSummary.mErrorSubSpec);
+      break;
+    case RDHFrameSummary::eStopMemorySize:
+      DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: RDH has bit stop set, but memory size is different from remaining block size."
+        " memory_size={} remaining_buffer_size={}", pSummary.mErrorMemorySize, lDataLen);
+      break;
+    case RDHFrameSummary::eZeroOffset:
       DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: Next block offset is 0.");
-      return false;
-    }
-
-    if (lOffsetNext >= lDataLen) {
+      break;
+    case RDHFrameSummary::eOffsetBeyondEnd:
       DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: Next offset points beyond end of data block (stop bit is not set).");
-      return false;
-    }
-
-    if (lMemSize >= lDataLen) {
-      DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: Memory size is larger than remaining data block size for packet {}", lPacketCnt);
-      return false;
-    }
-
-    lDataLen -= lOffsetNext;
-    lCurrData += lOffsetNext;
-    lPacketCnt += 1;
+      break;
+    case RDHFrameSummary::eMemorySizeBeyondEnd:
+      DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: Memory size is larger than remaining data block size for packet {}",
+        pSummary.mNumPages);
+      break;
   }
 
-  return true;
+  return false;
 }
 
-bool ReadoutDataUtils::filterEmptyTriggerBlocks(const char* pData, const std::size_t pLen)
+bool ReadoutDataUtils::filterEmptyTriggerBlocks(const RDHFrameSummary &pSummary, const std::size_t pLen)
 {
-  static std::size_t sNumFiltered64Blocks = 0;
-  static std::size_t sNumFiltered128Blocks = 0;
-  static std::size_t sNumFiltered16kBlocks = 0;
-
-  std::uint32_t lMemSize1, lOffsetNext1, lStopBit1;
-  std::uint32_t lMemSize2, lStopBit2;
-
-  if (pLen == 64 || pLen == 128 || pLen == 16384) { /* usual case */
-    try{
-      const auto R1 = RDHReader(pData, pLen);
-      lStopBit1 = R1.getStopBit();
-      lMemSize1 = R1.getMemorySize();
-      // check the 64B case
-      if (lStopBit1 && pLen == R1.getRDHSize() && lMemSize1 == R1.getRDHSize()) {
-        sNumFiltered64Blocks++;
-        if (sNumFiltered128Blocks % 250000 == 0) {
-          DDLOGF(fair::Severity::INFO, "Filtered {} of 64 B blocks in trigger mode.", sNumFiltered128Blocks);
-        }
-        return true;
-      } else if (lStopBit1) {
-        return false;
-      }
+  static thread_local std::size_t sNumFiltered64Blocks = 0;
+  static thread_local std::size_t sNumFiltered128Blocks = 0;
+  static thread_local std::size_t sNumFiltered16kBlocks = 0;
 
-      lOffsetNext1 = R1.getOffsetToNext();
-
-      if (lOffsetNext1 > pLen) {
-        DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: Invalid offset (beyond end of the buffer). offset={}", lOffsetNext1);
-      } if (lOffsetNext1 < R1.getRDHSize() ) {
-        DDLOGF(fair::Severity::ERROR, "BLOCK CHECK: Invalid offset (less than the RDH size). offset={}", lOffsetNext1);
-      }
+  if (!isEmptyTriggerBlockSize(pLen)) {
+    return false; // size does not match
+  }
 
-      const char *lRDH1 = pData;
-      const char *lRDH2 = lRDH1 + lOffsetNext1;
-      const std::size_t lRDH2Size = std::min(std::size_t(pLen - lOffsetNext1), std::size_t(8192));
+  // empty trigger: one RDH page of one RDH, or two RDH pages with the stop bit on the second. No payload
+  if (!pSummary.ok() || !pSummary.mStopBit || pSummary.mNumEmptyPages != pSummary.mNumPages) {
+    return false;
+  }
 
-      const auto R2 = RDHReader(lRDH2, lRDH2Size);
+  if (pSummary.mNumPages == 1 && pLen == pSummary.mRdhSize) {
+    sNumFiltered64Blocks++;
+    if (sNumFiltered64Blocks % 250000 == 0) {
+      DDLOGF(fair::Severity::INFO, "Filtered {} of 64 B blocks in trigger mode.", sNumFiltered64Blocks);
+    }
+    return true;
+  }
 
-      // check the subspecification
-      if (getSubSpecification(R1) != getSubSpecification(R2)) {
-        return false;
-      }
+  if (pSummary.mNumPages != 2) {
+    return false;
+  }
 
-      lMemSize2 = R2.getMemorySize();
-      lStopBit2 = R2.getStopBit();
+  if (pLen == 128) {
+    sNumFiltered128Blocks++;
+    if (sNumFiltered128Blocks % 250000 == 0) {
+      DDLOGF(fair::Severity::INFO, "Filtered {} of 128 B blocks in trigger mode.", sNumFiltered128Blocks);
+    }
+  } else if (pLen == 16384) {
+    sNumFiltered16kBlocks++;
+    if (sNumFiltered16kBlocks % 250000 == 0) {
+      DDLOGF(fair::Severity::INFO, "Filtered {} of 16 kiB blocks in trigger mode.", sNumFiltered16kBlocks);
+    }
+  }
 
-      if (lMemSize1 != lMemSize2 || lMemSize1 != R1.getRDHSize()) {
-        return false;
-      }
+  // looks like it should be empty trigger message
+  return true;
+}
 
-      if ((lStopBit1 != 0) || (lStopBit2 != 1)) {
-        return false ;
-      }
+template <typename RDH>
+bool ReadoutDataUtils::rdhSanityCheck(const char* pData, const std::size_t pLen)
+{
+  return rdhSanityCheck(scanHBFrame<RDH>(pData, pLen), pData, pLen);
+}
 
-      if (pLen == 128) {
-        sNumFiltered128Blocks++;
-        if (sNumFiltered128Blocks % 250000 == 0) {
-          DDLOGF(fair::Severity::INFO, "Filtered {} of 128 B blocks in trigger mode.", sNumFiltered128Blocks);
-        }
-      } else if (pLen == 16384) {
-        sNumFiltered16kBlocks++;
-        if (sNumFiltered16kBlocks % 250000 == 0) {
-          DDLOGF(fair::Severity::INFO, "Filtered {} of 16 kiB blocks in trigger mode.", sNumFiltered16kBlocks);
-        }
-      }
-    } catch (RDHReaderException &e) {
-      DDLOGF(fair::Severity::ERROR, e.what());
-      return false;
-    }
-  } else {
+template <typename RDH>
+bool ReadoutDataUtils::filterEmptyTriggerBlocks(const char* pData, const std::size_t pLen)
+{
+  if (!isEmptyTriggerBlockSize(pLen)) {
     return false; // size does not match
   }
+  return filterEmptyTriggerBlocks(scanHBFrame<RDH>(pData, pLen), pLen);
+}
 
-  // looks like it should be empty trigger message
-  return true;
+bool ReadoutDataUtils::rdhSanityCheck(const char* pData, const std::size_t pLen)
+{
+  return dispatchRdhVersion(rdhVersion(pData, pLen), [&](auto pTag) {
+    return rdhSanityCheck<typename decltype(pTag)::type>(pData, pLen);
+  });
 }
 
+bool ReadoutDataUtils::filterEmptyTriggerBlocks(const char* pData, const std::size_t pLen)
+{
+  return dispatchRdhVersion(rdhVersion(pData, pLen), [&](auto pTag) {
+    return filterEmptyTriggerBlocks<typename decltype(pTag)::type>(pData, pLen);
+  });
+}
+
+template bool ReadoutDataUtils::rdhSanityCheck<o2::header::RAWDataHeaderV4>(const char*, const std::size_t);
+template bool ReadoutDataUtils::rdhSanityCheck<o2::header::RAWDataHeaderV5>(const char*, const std::size_t);
+template bool ReadoutDataUtils::rdhSanityCheck<o2::header::RAWDataHeaderV6>(const char*, const std::size_t);
+template bool ReadoutDataUtils::filterEmptyTriggerBlocks<o2::header::RAWDataHeaderV4>(const char*, const std::size_t);
+template bool ReadoutDataUtils::filterEmptyTriggerBlocks<o2::header::RAWDataHeaderV5>(const char*, const std::size_t);
+template bool ReadoutDataUtils::filterEmptyTriggerBlocks<o2::header::RAWDataHeaderV6>(const char*, const std::size_t);
+template RDHFrameSummary ReadoutDataUtils::scanHBFrame<o2::header::RAWDataHeaderV4>(const char*, const std::size_t);
+template RDHFrameSummary ReadoutDataUtils::scanHBFrame<o2::header::RAWDataHeaderV5>(const char*, const std::size_t);
+template RDHFrameSummary ReadoutDataUtils::scanHBFrame<o2::header::RAWDataHeaderV6>(const char*, const std::size_t);
+
 std::istream& operator>>(std::istream& in, ReadoutDataUtils::SanityCheckMode& pRetVal)
 {
   std::string token;
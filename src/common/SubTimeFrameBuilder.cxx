@@ -34,20 +34,107 @@ using namespace o2::header;
 /// SubTimeFrameReadoutBuilder
 ////////////////////////////////////////////////////////////////////////////////
 
-SubTimeFrameReadoutBuilder::SubTimeFrameReadoutBuilder(FairMQChannel& pChan, bool pDplEnabled)
+SubTimeFrameReadoutBuilder::SubTimeFrameReadoutBuilder(std::shared_ptr<FMQUnsynchronizedPoolMemoryResource> pHeaderPool,
+  bool pDplEnabled)
   : mStf(nullptr),
     mDplEnabled(pDplEnabled)
 {
-  mHeaderMemRes = std::make_unique<FMQUnsynchronizedPoolMemoryResource>(
+  assert(pHeaderPool);
+
+  if (pHeaderPool->sliced()) {
+    mHeaderChunkObjects = pHeaderPool->objectSize() / headerObjectSize(mDplEnabled);
+    mHeaderChunkPool = std::move(pHeaderPool);
+  } else {
+    mHeaderMemRes = std::make_unique<FMQPoolMagazine>(std::move(pHeaderPool));
+  }
+}
+
+std::size_t SubTimeFrameReadoutBuilder::headerObjectSize(bool pDplEnabled)
+{
+  return pDplEnabled ?
+    sizeof(DataHeader) + sizeof(o2::framework::DataProcessingHeader) :
+    sizeof(DataHeader);
+}
+
+std::shared_ptr<FMQUnsynchronizedPoolMemoryResource> SubTimeFrameReadoutBuilder::createHeaderPool(
+  FairMQChannel& pChan, const std::size_t pHdrSegSize, bool pDplEnabled, const int pNumaNode,
+  const std::size_t pChunkObjects)
+{
+  return std::make_shared<FMQUnsynchronizedPoolMemoryResource>(
     "O2HeadersRegion",
     pChan,
-    std::size_t(256) << 20, /* make configurable */
-    mDplEnabled ?
-      sizeof(DataHeader) + sizeof(o2::framework::DataProcessingHeader) :
-      sizeof(DataHeader)
+    pHdrSegSize,
+    headerObjectSize(pDplEnabled) * std::max(std::size_t(1), pChunkObjects),
+    0,
+    pNumaNode,
+    (pChunkObjects > 0)
   );
 }
 
+FairMQMessagePtr SubTimeFrameReadoutBuilder::newHeaderMessage(
+  const o2::header::DataHeader::SubSpecificationType pSubSpec)
+{
+  // wait for free headers only once: after a timeout, use the fallback until the pool reclaims headers
+  if (!mHeaderChunkPool) {
+    auto lMsg = mHeaderMemRes->NewFairMQMessageWaitFor(headerAllocWait(mHeaderMemRes->pool()));
+    if (!lMsg && mRunning) {
+      lMsg = mHeaderMemRes->pool().NewFallbackMessage();
+    }
+    return lMsg;
+  }
+
+  // next slice of the open chunk of the equipment
+  const auto lObjSize = headerObjectSize(mDplEnabled);
+  auto &lChunk = mHeaderChunks[pSubSpec];
+
+  if (lChunk.mObj && lChunk.mUsed == mHeaderChunkObjects) {
+    mHeaderChunkPool->ReleaseSliceObject(lChunk.mObj);
+    lChunk = HeaderChunk();
+  }
+
+  if (!lChunk.mObj) {
+    lChunk.mObj = mHeaderChunkPool->NewSliceObjectWaitFor(headerAllocWait(*mHeaderChunkPool));
+    if (!lChunk.mObj) {
+      return mRunning ? mHeaderChunkPool->NewFallbackMessage(lObjSize) : nullptr;
+    }
+  }
+
+  return mHeaderChunkPool->NewSliceMessage(lChunk.mObj, lObjSize * lChunk.mUsed++, lObjSize);
+}
+
+/// Release the open header chunks. A chunk is reused when all its headers are freed.
+void SubTimeFrameReadoutBuilder::closeHeaderChunks()
+{
+  for (auto &lChunk : mHeaderChunks) {
+    if (lChunk.second.mObj) {
+      mHeaderChunkPool->ReleaseSliceObject(lChunk.second.mObj);
+      lChunk.second = HeaderChunk();
+    }
+  }
+}
+
+void SubTimeFrameReadoutBuilder::addHbFrames(
+  const o2::header::DataOrigin &pDataOrig,
+  const o2::header::DataHeader::SubSpecificationType pSubSpecification,
+  ReadoutSubTimeframeHeader& pHdr,
+  std::vector<FairMQMessagePtr>::iterator pHbFramesBegin, const std::size_t pHBFrameLen)
+{
+  if (pHBFrameLen == 0) {
+    return;
+  }
+
+  try {
+    const auto lVer = ReadoutDataUtils::rdhVersion(reinterpret_cast<const char*>(pHbFramesBegin[0]->GetData()),
+      pHbFramesBegin[0]->GetSize());
+    ReadoutDataUtils::dispatchRdhVersion(lVer, [&](auto pTag) {
+      addHbFrames<typename decltype(pTag)::type>(pDataOrig, pSubSpecification, pHdr, pHbFramesBegin, pHBFrameLen);
+    });
+  } catch (RDHReaderException &e) {
+    DDLOGF(fair::Severity::ERROR, "{} Not using {} HBFs", e.what(), pHBFrameLen);
+  }
+}
+
+template <typename RDH>
 void SubTimeFrameReadoutBuilder::addHbFrames(
   const o2::header::DataOrigin &pDataOrig,
   const o2::header::DataHeader::SubSpecificationType pSubSpecification,
@@ -66,97 +153,97 @@ void SubTimeFrameReadoutBuilder::addHbFrames(
 
   // TODO: remove when the readout supplies the value
   try {
-    const auto R = RDHReader(pHbFramesBegin[0]);
+    const auto R = RDHReaderT<RDH>(pHbFramesBegin[0]);
     mStf->updateFirstOrbit(R.getOrbit());
   } catch (...) {
     DDLOGF(fair::Severity::ERROR, "Error getting RDHReader instace. Not using {} HBFs", pHBFrameLen);
     return;
   }
 
-  std::vector<bool> lKeepBlocks(pHBFrameLen, true);
-
-  // filter empty trigger
-  {
-    if (ReadoutDataUtils::sEmptyTriggerHBFrameFilterring) {
-      // filter empty trigger start stop pages
-      for (std::size_t i = 0; i < pHBFrameLen; i++) {
-        if (lKeepBlocks[i] == false) {
-          continue; // already discarded
+  // keep/drop mask, reusing the storage of the previous update
+  mKeepBlocks.assign(pHBFrameLen, true);
+
+  // filter empty trigger and sanity check
+  const bool lFilterEmpty = ReadoutDataUtils::sEmptyTriggerHBFrameFilterring;
+  const bool lSanityCheck = ReadoutDataUtils::sRdhSanityCheckMode != ReadoutDataUtils::eNoSanityCheck;
+  LinkStats *lLinkStats = mLinkStatsCollector ? &mLinkStats[pSubSpecification] : nullptr;
+
+  if (lFilterEmpty || lSanityCheck || lLinkStats) {
+    for (std::size_t i = 0; i < pHBFrameLen; i++) {
+      const char *lData = reinterpret_cast<const char*>(pHbFramesBegin[i]->GetData());
+      const std::size_t lDataSize = pHbFramesBegin[i]->GetSize();
+
+      // NOTE: this can be implemented by checking trigger flags in the RDH for the TF bit
+      //       Perhaps switch to that method later, when the RHD is more stable
+      //       Fow now, we simply keep the first HBFrame of each equipment in the STF
+      bool lFilterCandidate = false;
+      if (lFilterEmpty) {
+        if (i == 0 && !mFirstFiltered[pSubSpecification]) {
+          mFirstFiltered[pSubSpecification] = true; // we keep the first HBFrame for each subspec (equipment)
+        } else {
+          lFilterCandidate = ReadoutDataUtils::isEmptyTriggerBlockSize(lDataSize);
         }
+      }
 
-        if (i == 0) {
-          // NOTE: this can be implemented by checking trigger flags in the RDH for the TF bit
-          //       Perhaps switch to that method later, when the RHD is more stable
-          //       Fow now, we simply keep the first HBFrame of each equipment in the STF
-          const auto R = RDHReader(pHbFramesBegin[0]);
-          const auto lSubSpec = ReadoutDataUtils::getSubSpecification(R);
-          if (!mFirstFiltered[lSubSpec]) {
-            mFirstFiltered[lSubSpec] = true;
-            continue; // we keep the first HBFrame for each subspec (equipment)
-          }
-        }
+      // the filter alone does not need to walk the pages of other HBFrames
+      if (!lFilterCandidate && !lSanityCheck && !lLinkStats) {
+        continue;
+      }
 
-        if (!ReadoutDataUtils::filterEmptyTriggerBlocks(
-              reinterpret_cast<const char*>(pHbFramesBegin[i]->GetData()),
-              pHbFramesBegin[i]->GetSize()) ) {
-          lKeepBlocks[i] = true;
-        } else {
-          lKeepBlocks[i] = false;
-        }
+      // walk the RDH pages once for all checks
+      const auto lSummary = ReadoutDataUtils::scanHBFrame<RDH>(lData, lDataSize);
+
+      // count all received HBFrames, before filtering
+      if (lLinkStats) {
+        lLinkStats->add(lSummary, lDataSize);
       }
-    }
-  }
 
-  // sanity check
-  {
-    if (ReadoutDataUtils::sRdhSanityCheckMode != ReadoutDataUtils::eNoSanityCheck) {
-      // check blocks individually
-      for (std::size_t i = 0; i < pHBFrameLen; i++) {
+      if (lFilterCandidate && ReadoutDataUtils::filterEmptyTriggerBlocks(lSummary, lDataSize)) {
+        mKeepBlocks[i] = false;
+        continue;
+      }
 
-        if (lKeepBlocks[i] == false) {
-          continue; // already filtered out
-        }
+      if (!lSanityCheck) {
+        continue;
+      }
 
-        const auto lOk = ReadoutDataUtils::rdhSanityCheck(
-          reinterpret_cast<const char*>(pHbFramesBegin[i]->GetData()),
-          pHbFramesBegin[i]->GetSize());
+      const auto lOk = ReadoutDataUtils::rdhSanityCheck(lSummary, lData, lDataSize);
 
-        if (!lOk && (ReadoutDataUtils::sRdhSanityCheckMode == ReadoutDataUtils::eSanityCheckDrop)) {
-          DDLOG(fair::Severity::WARNING) << "RDH SANITY CHECK: Removing data block";
+      if (!lOk && (ReadoutDataUtils::sRdhSanityCheckMode == ReadoutDataUtils::eSanityCheckDrop)) {
+        DDLOG(fair::Severity::WARNING) << "RDH SANITY CHECK: Removing data block";
 
-          lKeepBlocks[i] = false;
+        mKeepBlocks[i] = false;
 
-        } else if (!lOk && (ReadoutDataUtils::sRdhSanityCheckMode == ReadoutDataUtils::eSanityCheckPrint)) {
+      } else if (!lOk && (ReadoutDataUtils::sRdhSanityCheckMode == ReadoutDataUtils::eSanityCheckPrint)) {
 
-          DDLOG(fair::Severity::INFO) << "Printing data blocks of update with TF ID: " << pHdr.mTimeFrameId
-                    << ", Link ID: " << unsigned(pHdr.mLinkId);
+        DDLOG(fair::Severity::INFO) << "Printing data blocks of update with TF ID: " << pHdr.mTimeFrameId
+                  << ", Link ID: " << unsigned(pHdr.mLinkId);
 
-          // dump the data block, skipping data
-          std::size_t lCurrentDataIdx = 0;
+        // dump the data block, skipping data
+        std::size_t lCurrentDataIdx = 0;
 
-          const auto Ri = RDHReader(pHbFramesBegin[i]);
-          const auto lCru = Ri.getCruID();
-          const auto lEp = Ri.getEndPointID();
-          const auto lLink = Ri.getLinkID();
+        const auto Ri = RDHReaderT<RDH>(pHbFramesBegin[i]);
+        const auto lCru = Ri.getCruID();
+        const auto lEp = Ri.getEndPointID();
+        const auto lLink = Ri.getLinkID();
 
-          while (lCurrentDataIdx < pHbFramesBegin[i]->GetSize()) {
-            const auto lDataSizeLeft = std::size_t(pHbFramesBegin[i]->GetSize()) - lCurrentDataIdx;
+        while (lCurrentDataIdx < pHbFramesBegin[i]->GetSize()) {
+          const auto lDataSizeLeft = std::size_t(pHbFramesBegin[i]->GetSize()) - lCurrentDataIdx;
 
-            std::string lInfoStr = "RDH block (64 bytes in total) of [";
-            lInfoStr += std::to_string(i) + "] 8 kiB page";
+          std::string lInfoStr = "RDH block (64 bytes in total) of [";
+          lInfoStr += std::to_string(i) + "] 8 kiB page";
 
-            o2::header::hexDump(lInfoStr.c_str(),
-              reinterpret_cast<char*>(pHbFramesBegin[i]->GetData()) + lCurrentDataIdx,
-              std::size_t(std::min(std::size_t(64), lDataSizeLeft)));
+          o2::header::hexDump(lInfoStr.c_str(),
+            reinterpret_cast<char*>(pHbFramesBegin[i]->GetData()) + lCurrentDataIdx,
+            std::size_t(std::min(std::size_t(64), lDataSizeLeft)));
 
-            DDLOG(fair::Severity::INFO) << "RDH info CRU: " << lCru << " Endpoint: " << lEp << " Link: " << lLink;
+          DDLOG(fair::Severity::INFO) << "RDH info CRU: " << lCru << " Endpoint: " << lEp << " Link: " << lLink;
 
-            const auto R = RDHReader(
-              reinterpret_cast<const char*>(pHbFramesBegin[i]->GetData()) + lCurrentDataIdx,
-              lDataSizeLeft
-            );
-            lCurrentDataIdx += std::min(std::size_t(R.getOffsetToNext()), lDataSizeLeft);
-          }
+          const auto R = RDHReaderT<RDH>(
+            reinterpret_cast<const char*>(pHbFramesBegin[i]->GetData()) + lCurrentDataIdx,
+            lDataSizeLeft
+          );
+          lCurrentDataIdx += std::min(std::size_t(R.getOffsetToNext()), lDataSizeLeft);
         }
       }
     }
@@ -164,64 +251,144 @@ void SubTimeFrameReadoutBuilder::addHbFrames(
 
   assert(pHdr.mTimeFrameId == mStf->header().mId);
 
-  const EquipmentIdentifier lEqId = EquipmentIdentifier(
+  // O2 headers of the equipment, as laid out by header::Stack. Only the payload size differs per HBFrame.
+  DataHeader lDataHdr(
     o2::header::gDataDescriptionRawData,
     pDataOrig,
-    pSubSpecification);
+    pSubSpecification,
+    0
+  );
+  lDataHdr.payloadSerializationMethod = gSerializationMethodNone;
+  lDataHdr.flagsNextHeader = mDplEnabled ? 1 : 0;
+  std::memcpy(mHdrTemplate.data(), &lDataHdr, sizeof(DataHeader));
+
+  if (mDplEnabled) {
+    const o2::framework::DataProcessingHeader lDplHdr{mStf->header().mId};
+    std::memcpy(mHdrTemplate.data() + sizeof(DataHeader), &lDplHdr, sizeof(o2::framework::DataProcessingHeader));
+  }
+  const std::size_t lHdrSize = headerObjectSize(mDplEnabled);
 
-  for (size_t i = 0; i < pHBFrameLen; i++) {
+  for (size_t i = 0; i < pHBFrameLen; ) {
 
-    if (lKeepBlocks[i] == false) {
+    if (mKeepBlocks[i] == false) {
+      i++;
       continue; // already filtered out
     }
 
-    std::unique_ptr<FairMQMessage> lHdrMsg;
-
-    DataHeader lDataHdr(
-      lEqId.mDataDescription,
-      lEqId.mDataOrigin,
-      lEqId.mSubSpecification,
-      pHbFramesBegin[i]->GetSize()
-    );
-    lDataHdr.payloadSerializationMethod = gSerializationMethodNone;
+    // coalescing: HBFrames [i, lEnd) that are kept go into one payload
+    std::size_t lEnd = i + 1;
+    std::size_t lPayloadSize = pHbFramesBegin[i]->GetSize();
 
-    if (mDplEnabled) {
-      auto lStack = Stack(
-        lDataHdr,
-        o2::framework::DataProcessingHeader{mStf->header().mId}
-      );
-
-      lHdrMsg = mHeaderMemRes->NewFairMQMessage(lStack.size());
-      if (lHdrMsg) {
-        std::memcpy(lHdrMsg->GetData(), lStack.data(), lStack.size());
+    if (mCoalesceMemRes) {
+      for (std::size_t j = i + 1; j < pHBFrameLen; j++) {
+        if (mKeepBlocks[j] == false) {
+          continue;
+        }
+        if (lPayloadSize + pHbFramesBegin[j]->GetSize() > mCoalesceMaxSize) {
+          break;
+        }
+        lPayloadSize += pHbFramesBegin[j]->GetSize();
+        lEnd = j + 1;
       }
-    } else {
-      auto lHdrMsgStack = Stack(lDataHdr);
+    }
 
-      lHdrMsg = mHeaderMemRes->NewFairMQMessage(lHdrMsgStack.size());
-      if (lHdrMsg) {
-        std::memcpy(lHdrMsg->GetData(), lHdrMsgStack.data(), lHdrMsgStack.size());
-      }
+    FairMQMessagePtr lDataMsg;
+    if (lEnd - i > 1) {
+      lDataMsg = coalesceHbFrames(pHbFramesBegin, i, lEnd, lPayloadSize);
+    }
+    if (!lDataMsg) {
+      lEnd = i + 1;
+      lDataMsg = std::move(pHbFramesBegin[i]);
     }
+    i = lEnd;
 
+    auto lHdrMsg = newHeaderMessage(pSubSpecification);
     if (!lHdrMsg) {
       DDLOG(fair::Severity::ERROR) << "Allocation error: HbFrame::DataHeader: " << sizeof(DataHeader);
       throw std::bad_alloc();
     }
 
+    // write the headers directly into the pool object
+    char *lHdrData = reinterpret_cast<char*>(lHdrMsg->GetData());
+    std::memcpy(lHdrData, mHdrTemplate.data(), lHdrSize);
+    reinterpret_cast<DataHeader*>(lHdrData)->payloadSize = lDataMsg->GetSize();
+
     mStf->addStfData(lDataHdr,
-      SubTimeFrame::StfData{ std::move(lHdrMsg), std::move(pHbFramesBegin[i]) }
+      SubTimeFrame::StfData{ std::move(lHdrMsg), std::move(lDataMsg) }
     );
   }
+}
+
+void SubTimeFrameReadoutBuilder::enableHbfCoalescing(FairMQChannel& pChan, const std::size_t pRegionSize,
+  const std::size_t pMaxPayloadSize, const int pNumaNode)
+{
+  mCoalesceMaxSize = pMaxPayloadSize;
+  mCoalesceMemRes = std::make_unique<RegionAllocatorResource<>>(
+    "O2HbfCoalesceRegion",
+    pChan,
+    pRegionSize,
+    0,
+    RegionAllocatorResource<>::eReclaimBestFit, // payloads of varying size, up to the coalescing limit
+    pNumaNode
+  );
+}
+
+/// Copy the kept HBFrames [pFirst, pEnd) into one payload message. The HBFrames are released.
+/// Returns nullptr if the region has no free memory: the HBFrames are then added individually.
+FairMQMessagePtr SubTimeFrameReadoutBuilder::coalesceHbFrames(std::vector<FairMQMessagePtr>::iterator pHbFramesBegin,
+  const std::size_t pFirst, const std::size_t pEnd, const std::size_t pPayloadSize)
+{
+  // NOTE: the readout pages cannot be merged in place: a message can only be created in a region
+  //       mapped by this process, and readout returns each page individually
+  auto lMsg = mCoalesceMemRes->TryNewFairMQMessage(pPayloadSize);
+  if (!lMsg) {
+    static thread_local std::uint64_t sNumNoMemory = 0;
+    if (sNumNoMemory++ % 1000 == 0) {
+      DDLOGF(fair::Severity::WARNING, "HBFrame coalescing region is full. Sending HBFrames individually. "
+        "total_occurrences={}", sNumNoMemory);
+    }
+    return nullptr;
+  }
+
+  char *lDst = reinterpret_cast<char*>(lMsg->GetData());
+  for (std::size_t i = pFirst; i < pEnd; i++) {
+    if (mKeepBlocks[i] == false) {
+      continue;
+    }
+    std::memcpy(lDst, pHbFramesBegin[i]->GetData(), pHbFramesBegin[i]->GetSize());
+    lDst += pHbFramesBegin[i]->GetSize();
+    pHbFramesBegin[i].reset(); // return the page to readout
+  }
+  assert(lDst == reinterpret_cast<char*>(lMsg->GetData()) + pPayloadSize);
 
+  return lMsg;
 }
 
+template void SubTimeFrameReadoutBuilder::addHbFrames<o2::header::RAWDataHeaderV4>(const o2::header::DataOrigin&,
+  const o2::header::DataHeader::SubSpecificationType, ReadoutSubTimeframeHeader&,
+  std::vector<FairMQMessagePtr>::iterator, const std::size_t);
+template void SubTimeFrameReadoutBuilder::addHbFrames<o2::header::RAWDataHeaderV5>(const o2::header::DataOrigin&,
+  const o2::header::DataHeader::SubSpecificationType, ReadoutSubTimeframeHeader&,
+  std::vector<FairMQMessagePtr>::iterator, const std::size_t);
+template void SubTimeFrameReadoutBuilder::addHbFrames<o2::header::RAWDataHeaderV6>(const o2::header::DataOrigin&,
+  const o2::header::DataHeader::SubSpecificationType, ReadoutSubTimeframeHeader&,
+  std::vector<FairMQMessagePtr>::iterator, const std::size_t);
+
 std::unique_ptr<SubTimeFrame> SubTimeFrameReadoutBuilder::getStf()
 {
   std::unique_ptr<SubTimeFrame> lStf = std::move(mStf);
   mStf = nullptr;
   mFirstFiltered.clear();
 
+  // headers of the next STF start in new chunks
+  if (mHeaderChunkPool) {
+    closeHeaderChunks();
+  }
+
+  if (mLinkStatsCollector) {
+    mLinkStatsCollector->merge(mLinkStats);
+  }
+
   return lStf;
 }
 
@@ -230,21 +397,27 @@ std::unique_ptr<SubTimeFrame> SubTimeFrameReadoutBuilder::getStf()
 /// SubTimeFrameFileBuilder
 ////////////////////////////////////////////////////////////////////////////////
 
-SubTimeFrameFileBuilder::SubTimeFrameFileBuilder(FairMQChannel& pChan, const std::size_t pDataSegSize, bool pDplEnabled)
+SubTimeFrameFileBuilder::SubTimeFrameFileBuilder(FairMQChannel& pChan, const std::size_t pDataSegSize,
+  const std::size_t pHdrSegSize, bool pDplEnabled, const int pNumaNode)
   : mDplEnabled(pDplEnabled)
 {
   mHeaderMemRes = std::make_unique<RegionAllocatorResource<alignof(o2::header::DataHeader)>>(
     "O2HeadersRegion_FileSource",
     pChan,
-    std::size_t(256) << 20, /* make configurable */
-    0
+    pHdrSegSize,
+    0,
+    RegionAllocatorResource<alignof(o2::header::DataHeader)>::eReclaimBestFit, // small, mixed size headers
+    pNumaNode,
+    false // no slabs: the size classes would round the headers up to the next power of 2
   );
 
   mDataMemRes = std::make_unique<RegionAllocatorResource<>>(
     "O2DataRegion_FileSource",
     pChan,
     pDataSegSize,
-    0 // TODO: GPU flags
+    0, // TODO: GPU flags
+    RegionAllocatorResource<>::eReclaimLargest,
+    pNumaNode
   );
 }
 
@@ -289,7 +462,7 @@ void SubTimeFrameFileBuilder::adaptHeaders(SubTimeFrame *pStf)
               o2::framework::DataProcessingHeader{pStf->header().mId}
             );
 
-            lStfDataIter.mHeader = mHeaderMemRes->NewFairMQMessage(lStack.size());
+            lStfDataIter.mHeader = newHeaderMessage(lStack.size());
             if (lStfDataIter.mHeader) {
               assert(lStfDataIter.mHeader->GetSize() > sizeof (DataHeader));
               std::memcpy(lStfDataIter.mHeader->GetData(), lStack.data(), lStack.size());
@@ -305,22 +478,28 @@ void SubTimeFrameFileBuilder::adaptHeaders(SubTimeFrame *pStf)
 /// TimeFrameBuilder
 ////////////////////////////////////////////////////////////////////////////////
 
-TimeFrameBuilder::TimeFrameBuilder(FairMQChannel& pChan, const std::size_t pDataSegSize, bool pDplEnabled)
+TimeFrameBuilder::TimeFrameBuilder(FairMQChannel& pChan, const std::size_t pDataSegSize,
+  const std::size_t pHdrSegSize, bool pDplEnabled, const int pNumaNode)
   : mDplEnabled(pDplEnabled),
     mOutputChan(pChan)
 {
   mHeaderMemRes = std::make_unique<RegionAllocatorResource<alignof(o2::header::DataHeader)>>(
     "O2HeadersRegion",
     pChan,
-    std::size_t(256) << 20, /* make configurable */
-    0 /* dont need registration flags for headers */
+    pHdrSegSize,
+    0, /* dont need registration flags for headers */
+    RegionAllocatorResource<alignof(o2::header::DataHeader)>::eReclaimBestFit, // small, mixed size headers
+    pNumaNode,
+    false // no slabs: the size classes would round the headers up to the next power of 2
   );
 
   mDataMemRes = std::make_unique<RegionAllocatorResource<>>(
     "O2DataRegion_FileSource",
     pChan,
     pDataSegSize,
-    0 // TODO: GPU flags
+    0, // TODO: GPU flags
+    RegionAllocatorResource<>::eReclaimLargest,
+    pNumaNode
   );
 }
 
@@ -376,7 +555,7 @@ void TimeFrameBuilder::adaptHeaders(SubTimeFrame *pStf)
             );
 
             if (lOutChannelType == fair::mq::Transport::SHM) {
-              lStfDataIter.mHeader = mHeaderMemRes->NewFairMQMessage(lStack.size());
+              lStfDataIter.mHeader = getNewHeaderMessage(lStack.size());
             } else {
               lStfDataIter.mHeader = mOutputChan.NewMessage(lStack.size());
             }
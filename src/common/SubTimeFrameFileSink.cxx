@@ -167,9 +167,11 @@ void SubTimeFrameFileSink::DataHandlerThread(const unsigned pIdx)
   // wait for running
   mDeviceI.WaitForRunningState();
 
+  stf_pipeline::StageBatch lInput(mPipelineI, mPipelineStageIn);
+
   while (mDeviceI.IsRunningState()) {
     // Get the next STF
-    std::unique_ptr<SubTimeFrame> lStf = mPipelineI.dequeue(mPipelineStageIn);
+    std::unique_ptr<SubTimeFrame> lStf = lInput.next();
     if (!lStf) {
       // input queue is stopped, bail out
       break;
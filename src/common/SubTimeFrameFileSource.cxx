@@ -40,17 +40,20 @@ using namespace std::chrono_literals;
 /// SubTimeFrameFileSource
 ////////////////////////////////////////////////////////////////////////////////
 
-void SubTimeFrameFileSource::start(FairMQChannel& pDstChan, const bool pDplEnabled)
+void SubTimeFrameFileSource::start(FairMQChannel& pDstChan, const bool pDplEnabled, const int pNumaNode)
 {
   if (enabled()) {
     mDstChan = &pDstChan;
     mDplEnabled = pDplEnabled;
+    mNumaNode = pNumaNode;
 
     if (!mFileBuilder) {
       mFileBuilder = std::make_unique<SubTimeFrameFileBuilder>(
         pDstChan,
         mRegionSizeMB << 20,
-        mDplEnabled
+        mHdrRegionSizeMB << 20,
+        mDplEnabled,
+        mNumaNode
       );
     }
 
@@ -105,7 +108,10 @@ bpo::options_description SubTimeFrameFileSource::getProgramOptions()
     OptionKeyStfSourceRegionSize,
     bpo::value<std::uint64_t>()->default_value(1024),
     "Size of the memory region for (Sub)TimeFrames data in MiB. "
-    "Note: make sure the region can fit several (Sub)TimeFrames to avoid deadlocks.");
+    "Note: make sure the region can fit several (Sub)TimeFrames to avoid deadlocks.")(
+    OptionKeyStfHeadersRegionSize,
+    bpo::value<std::uint64_t>()->default_value(256),
+    "Size of the memory region for (Sub)TimeFrames O2 headers in MiB. Auto sizing: 0");
 
   return lSinkDesc;
 }
@@ -155,6 +161,7 @@ bool SubTimeFrameFileSource::loadVerifyConfig(const FairMQProgOptions& pFMQProgO
   mRepeat = pFMQProgOpt.GetValue<bool>(OptionKeyStfSourceRepeat);
   mLoadRate = pFMQProgOpt.GetValue<float>(OptionKeyStfLoadRate);
   mRegionSizeMB = pFMQProgOpt.GetValue<std::uint64_t>(OptionKeyStfSourceRegionSize);
+  mHdrRegionSizeMB = pFMQProgOpt.GetValue<std::uint64_t>(OptionKeyStfHeadersRegionSize);
 
   mFilesVector = getDataFileList();
   if (mFilesVector.empty()) {
@@ -167,6 +174,11 @@ bool SubTimeFrameFileSource::loadVerifyConfig(const FairMQProgOptions& pFMQProgO
     return false;
   }
 
+  // auto sizing: headers are small compared to the data they describe
+  if (mHdrRegionSizeMB == 0) {
+    mHdrRegionSizeMB = std::max(std::size_t(16), mRegionSizeMB / 32);
+  }
+
   // print options
   DDLOGF(fair::Severity::INFO, "(Sub)TimeFrame source :: enabled         = {}", (mEnabled ? "yes" : "no"));
   DDLOGF(fair::Severity::INFO, "(Sub)TimeFrame source :: directory       = {}", mDir);
@@ -174,6 +186,7 @@ bool SubTimeFrameFileSource::loadVerifyConfig(const FairMQProgOptions& pFMQProgO
   DDLOGF(fair::Severity::INFO, "(Sub)TimeFrame source :: repeat data     = {}", mRepeat);
   DDLOGF(fair::Severity::INFO, "(Sub)TimeFrame source :: num files       = {}", mFilesVector.size());
   DDLOGF(fair::Severity::INFO, "(Sub)TimeFrame source :: region size(MiB)= {}", mRegionSizeMB);
+  DDLOGF(fair::Severity::INFO, "(Sub)TimeFrame source :: header size(MiB)= {}", mHdrRegionSizeMB);
 
   return true;
 }
@@ -211,8 +224,11 @@ void SubTimeFrameFileSource::DataInjectThread()
 /// File reading thread
 void SubTimeFrameFileSource::DataHandlerThread()
 {
-  // inject rate
-  const std::chrono::microseconds lIntervalUs(mLoadRate > 0.f ? unsigned(1000000.f / mLoadRate) : 0);
+  // the thread is reading into the data region
+  if (mNumaNode != NumaUtils::cNoNode) {
+    NumaUtils::pinThread(mNumaNode);
+  }
+
   // Load the sorted list of StfFiles if empty
   if (mFilesVector.empty()) {
     mFilesVector = getDataFileList();
@@ -238,11 +254,6 @@ void SubTimeFrameFileSource::DataHandlerThread()
       // DDLOG(fair::Severity::DEBUG) << "FileSource: opened new file " << lFileNameAbs.string();
 
       while (mRunning) {
-        // prevent large read-ahead
-        while (mRunning && mReadStfQueue.size() > 3) {
-          std::this_thread::sleep_for(lIntervalUs);
-        }
-
         // read STF from file
         auto lStfPtr = lStfReader.read(*mFileBuilder);
 
@@ -257,7 +268,10 @@ void SubTimeFrameFileSource::DataHandlerThread()
             lCurrentOrbit += 256;
           }
 
-          mReadStfQueue.push(std::move(lStfPtr));
+          // blocks while the read-ahead queue is full
+          if (!mReadStfQueue.push(std::move(lStfPtr))) {
+            break; // stopped
+          }
         } else {
           // bad file?
           break; // EOF or !running
@@ -260,7 +260,7 @@ std::uint64_t SubTimeFrameFileWriter::_write(const SubTimeFrame& pStf)
       const auto l3StfFileSize = lStfSizeInFile;
 
       for (const auto& lStfData : mStfData) {
-        fmt::memory_buffer lValRow;
+        fmt::memory_buffer lHdrCols;
 
         const DataHeader &lDH = lStfData->getDataHeader();
 
@@ -272,31 +272,62 @@ std::uint64_t SubTimeFrameFileWriter::_write(const SubTimeFrame& pStf)
         const auto l8HdrOff = lDataOffset;
         lDataOffset += lStfData->mHeader->GetSize();
         const auto l9HdrSize = lStfData->mHeader->GetSize();
-        const auto l10DataOff = lDataOffset;
+        const auto lPayloadOff = lDataOffset;
         lDataOffset += lStfData->mData->GetSize();
-        const auto l11DataSize = lStfData->mData->GetSize();
-
-        impl::sInfoVal(lValRow, impl::TF_ID, l1StfId);
-        impl::sInfoVal(lValRow, impl::TF_OFFSET, l2StfFileOff);
-        impl::sInfoVal(lValRow, impl::TF_SIZE, l3StfFileSize);
-        impl::sInfoVal(lValRow, impl::ORIGIN, l4DataOrigin.str);
-        impl::sInfoVal(lValRow, impl::DESC, l5DataDescription.str);
-        impl::sInfoVal(lValRow, impl::SUBSPEC, l6SubSpec);
-        impl::sInfoVal(lValRow, impl::DATA_IDX, l7DataIndex);
-        impl::sInfoVal(lValRow, impl::HDR_OFF, l8HdrOff);
-        impl::sInfoVal(lValRow, impl::HDR_SIZE, l9HdrSize);
-        impl::sInfoVal(lValRow, impl::DATA_OFF, l10DataOff);
-        impl::sInfoVal(lValRow, impl::DATA_SIZE, l11DataSize);
-
-        // only if the O2 header is RAWDATA
-        if (lDH.dataDescription == gDataDescriptionRawData) {
+        const auto lPayloadSize = lStfData->mData->GetSize();
+
+        impl::sInfoVal(lHdrCols, impl::TF_ID, l1StfId);
+        impl::sInfoVal(lHdrCols, impl::TF_OFFSET, l2StfFileOff);
+        impl::sInfoVal(lHdrCols, impl::TF_SIZE, l3StfFileSize);
+        impl::sInfoVal(lHdrCols, impl::ORIGIN, l4DataOrigin.str);
+        impl::sInfoVal(lHdrCols, impl::DESC, l5DataDescription.str);
+        impl::sInfoVal(lHdrCols, impl::SUBSPEC, l6SubSpec);
+        impl::sInfoVal(lHdrCols, impl::DATA_IDX, l7DataIndex);
+        impl::sInfoVal(lHdrCols, impl::HDR_OFF, l8HdrOff);
+        impl::sInfoVal(lHdrCols, impl::HDR_SIZE, l9HdrSize);
+
+        const std::string_view lHdrColsStr(lHdrCols.begin(), lHdrCols.size());
+
+        // only if the O2 header is RAWDATA: one row for each HBFrame of the payload (several if coalesced)
+        if (lDH.dataDescription != gDataDescriptionRawData) {
+          fmt::memory_buffer lValRow;
+          impl::sInfoVal(lValRow, impl::DATA_OFF, lPayloadOff);
+          impl::sInfoVal(lValRow, impl::DATA_SIZE, lPayloadSize);
+          mInfoFile << lHdrColsStr << std::string_view(lValRow.begin(), lValRow.size()) << '\n';
+          continue;
+        }
+
+        const char *lPayload = reinterpret_cast<const char*>(lStfData->mData->GetData());
+        std::size_t lHbfOff = 0;
+
+        do {
+          fmt::memory_buffer lValRow;
+          std::size_t lHbfSize = lPayloadSize - lHbfOff;
+          RDHFrameSummary lSummary;
+
           try {
-            const auto R = RDHReader(lStfData->mData);
-            const auto [l12MemSize, l13StopBit] = ReadoutDataUtils::getHBFrameMemorySize(lStfData->mData);
-            const auto l14FeeId = R.getFeeID();
-            const auto l15Orbit = R.getOrbit();
-            const auto l16Bc = R.getBC();
-            const auto l17Trig = R.getTriggerType();
+            // one walk over the RDH pages of the HBFrame
+            lSummary = ReadoutDataUtils::scanHBFrame(lPayload + lHbfOff, lPayloadSize - lHbfOff);
+            if (lSummary.ok() && lSummary.mSize > 0) {
+              lHbfSize = lSummary.mSize;
+            }
+          } catch (RDHReaderException &e) {
+            DDLOGF(fair::Severity::ERROR, e.what());
+          }
+
+          const auto l10DataOff = lPayloadOff + lHbfOff;
+          const auto l11DataSize = lHbfSize;
+
+          impl::sInfoVal(lValRow, impl::DATA_OFF, l10DataOff);
+          impl::sInfoVal(lValRow, impl::DATA_SIZE, l11DataSize);
+
+          if (lSummary.mNumPages > 0) {
+            const auto l12MemSize = lSummary.mMemorySize;
+            const auto l13StopBit = lSummary.mStopBit && (lSummary.mStatus != RDHFrameSummary::eStopMemorySize);
+            const auto l14FeeId = lSummary.mFeeId;
+            const auto l15Orbit = lSummary.mOrbit;
+            const auto l16Bc = lSummary.mBC;
+            const auto l17Trig = lSummary.mTriggerType;
 
             impl::sInfoVal(lValRow, impl::RDH_MEM_SIZE, l12MemSize);
             impl::sInfoVal(lValRow, impl::RDH_STOP_BIT, l13StopBit ? 1 : 0);
@@ -304,12 +335,14 @@ std::uint64_t SubTimeFrameFileWriter::_write(const SubTimeFrame& pStf)
             impl::sInfoVal(lValRow, impl::RDH_ORBIT, l15Orbit);
             impl::sInfoVal(lValRow, impl::RDH_BC, l16Bc);
             impl::sInfoVal(lValRow, impl::RDH_TRG, l17Trig);
-          } catch (RDHReaderException &e) {
-            DDLOGF(fair::Severity::ERROR, e.what());
+          } else if (lSummary.mStatus == RDHFrameSummary::eShortData) {
+            DDLOGF(fair::Severity::ERROR, "Sidecar: data block is shorter than RDH. size={}", lHbfSize);
           }
-        }
 
-        mInfoFile << std::string_view(lValRow.begin(), lValRow.size()) << '\n';
+          mInfoFile << lHdrColsStr << std::string_view(lValRow.begin(), lValRow.size()) << '\n';
+
+          lHbfOff += lHbfSize;
+        } while (lHbfOff < lPayloadSize);
       }
       mInfoFile.flush();
     } catch (const std::ios_base::failure& eFailExc) {
@@ -22,8 +22,12 @@
 #include <condition_variable>
 #include <iterator>
 #include <chrono>
+#include <memory>
+#include <thread>
+#include <string>
 
 #include <Utilities.h>
+#include <DataDistLogger.h>
 
 namespace o2
 {
@@ -176,7 +180,7 @@ class ConcurrentContainerImpl
     std::deque<T> mContainer;
     mutable std::mutex mLock;
     std::condition_variable mCond;
-    bool mRunning = true;
+    std::atomic_bool mRunning = true; // written under mLock, is_running() reads it without the lock
   };
 
   std::unique_ptr<QueueInternals> mImpl;
@@ -202,21 +206,299 @@ using ConcurrentLifo = impl::ConcurrentContainerImpl<T, impl::eLIFO>;
 template <class T>
 using ConcurrentStack = ConcurrentLifo<T>;
 
+///
+///  Bounded single-producer single-consumer FIFO
+///
+///  Same push/pop/stop semantics as ConcurrentFifo, for links with exactly one producer
+///  and one consumer thread. A hand-off costs a few atomic operations. The waiting side
+///  spins for a short time, then yields, and only then parks on the condition variable.
+///  NOTE: push() blocks while the ring is full. It returns false (and drops the element) if
+///        the ring is stopped while full.
+///
+template <typename T>
+class ConcurrentSpscFifo
+{
+ public:
+  typedef T value_type;
+
+  static constexpr std::size_t cDefaultCapacity = 4096;
+
+  explicit ConcurrentSpscFifo(const std::size_t pCapacity = cDefaultCapacity)
+  : mImpl(std::make_unique<RingInternals>(pCapacity)) { }
+
+  ConcurrentSpscFifo(ConcurrentSpscFifo &&) = default;
+
+  ~ConcurrentSpscFifo() {
+    if (mImpl) {
+      stop();
+    }
+  }
+
+  void stop()
+  {
+    mImpl->mRunning = false;
+
+    std::scoped_lock lLock(mImpl->mLock);
+    mImpl->mCond.notify_all();
+  }
+
+  /// Drop all queued elements. Must be called from the consumer thread, or when the producer is idle.
+  void flush()
+  {
+    T lDrop;
+    while (try_pop(lDrop)) { }
+  }
+
+  template <typename... Args>
+  bool push(Args&&... args)
+  {
+    auto &lRing = *mImpl;
+    const auto lTail = lRing.mTail.load(std::memory_order_relaxed);
+
+    if (lTail - lRing.mHeadCache >= lRing.mCapacity) {
+      lRing.mHeadCache = lRing.mHead.load(std::memory_order_acquire);
+
+      if (lTail - lRing.mHeadCache >= lRing.mCapacity) {
+        const auto lHasRoom = [&]() { return (lTail - lRing.mHead.load(std::memory_order_acquire)) < lRing.mCapacity; };
+        if (!wait(lHasRoom, lRing.mProducerParked, std::chrono::microseconds(-1))) {
+          return false;
+        }
+        lRing.mHeadCache = lRing.mHead.load(std::memory_order_acquire);
+      }
+    }
+
+    lRing.mSlots[lTail & lRing.mMask] = T(std::forward<Args>(args)...);
+    lRing.mTail.store(lTail + 1, std::memory_order_release);
+
+    wake(lRing.mConsumerParked);
+    return true;
+  }
+
+  bool pop(T& d)
+  {
+    return pop_wait_for(d, std::chrono::microseconds(-1));
+  }
+
+  /// Negative timeout waits until an element is available or the ring is stopped
+  bool pop_wait_for(T& d, const std::chrono::microseconds &us)
+  {
+    if (!available()) {
+      auto &lRing = *mImpl;
+      const auto lHead = lRing.mHead.load(std::memory_order_relaxed);
+      const auto lHasData = [&]() { return lRing.mTail.load(std::memory_order_acquire) != lHead; };
+      if (!wait(lHasData, lRing.mConsumerParked, us)) {
+        return false;
+      }
+    }
+
+    return try_pop(d);
+  }
+
+  template <class OutputIt>
+  std::size_t pop_n(const unsigned long pCnt, OutputIt pDstIter)
+  {
+    T lFirst;
+    if (!pop(lFirst)) {
+      return 0; // should stop
+    }
+
+    *pDstIter++ = std::move(lFirst);
+    return 1 + try_pop_n(pCnt - 1, pDstIter);
+  }
+
+  bool try_pop(T& d)
+  {
+    return try_pop_n(1, &d) == 1;
+  }
+
+  template <class OutputIt>
+  std::size_t try_pop_n(const std::size_t pCnt, OutputIt pDstIter)
+  {
+    auto &lRing = *mImpl;
+    const auto lHead = lRing.mHead.load(std::memory_order_relaxed);
+
+    if (!available()) {
+      return 0;
+    }
+
+    // the cached tail can be behind the producer: refresh it if it limits the batch
+    if (lRing.mTailCache - lHead < pCnt) {
+      lRing.mTailCache = lRing.mTail.load(std::memory_order_acquire);
+    }
+
+    const std::size_t lCnt = std::min(pCnt, lRing.mTailCache - lHead);
+    for (std::size_t i = 0; i < lCnt; i++) {
+      *pDstIter++ = std::move(lRing.mSlots[(lHead + i) & lRing.mMask]);
+    }
+
+    lRing.mHead.store(lHead + lCnt, std::memory_order_release);
+
+    wake(lRing.mProducerParked);
+    return lCnt;
+  }
+
+  std::size_t size() const
+  {
+    return mImpl->mTail.load(std::memory_order_acquire) - mImpl->mHead.load(std::memory_order_acquire);
+  }
+
+  std::size_t capacity() const { return mImpl->mCapacity; }
+
+  bool is_running() const { return mImpl->mRunning; }
+
+ private:
+  // spin and yield counts before parking
+  static constexpr unsigned cSpinCnt = 1024;
+  static constexpr unsigned cYieldCnt = 64;
+  // longest single park, bounds reaction time to missed notifications
+  static constexpr std::chrono::milliseconds cParkSlice = std::chrono::milliseconds(10);
+
+  struct RingInternals {
+    explicit RingInternals(const std::size_t pCapacity)
+    : mCapacity(roundUpPow2(std::max(pCapacity, std::size_t(2)))),
+      mMask(mCapacity - 1),
+      mSlots(mCapacity)
+    { }
+
+    static std::size_t roundUpPow2(const std::size_t pVal) {
+      std::size_t lRet = 1;
+      while (lRet < pVal) {
+        lRet <<= 1;
+      }
+      return lRet;
+    }
+
+    const std::size_t mCapacity;
+    const std::size_t mMask;
+    std::vector<T> mSlots;
+
+    // consumer side
+    alignas(64) std::atomic_size_t mHead = 0;
+    std::size_t mTailCache = 0;
+    std::atomic_bool mConsumerParked = false;
+
+    // producer side
+    alignas(64) std::atomic_size_t mTail = 0;
+    std::size_t mHeadCache = 0;
+    std::atomic_bool mProducerParked = false;
+
+    alignas(64) std::atomic_bool mRunning = true;
+    std::mutex mLock;
+    std::condition_variable mCond;
+  };
+
+  // consumer: check for queued elements and refresh the cached tail
+  bool available()
+  {
+    auto &lRing = *mImpl;
+    const auto lHead = lRing.mHead.load(std::memory_order_relaxed);
+    if (lHead == lRing.mTailCache) {
+      lRing.mTailCache = lRing.mTail.load(std::memory_order_acquire);
+    }
+    return (lHead != lRing.mTailCache);
+  }
+
+  static inline void cpu_relax()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+  }
+
+  // Adaptive wait for the condition: spin, yield, then park. Returns the state of the condition.
+  template <typename Pred>
+  bool wait(Pred &&pReady, std::atomic_bool &pParked, const std::chrono::microseconds &pTimeout)
+  {
+    using clock = std::chrono::steady_clock;
+    auto &lRing = *mImpl;
+
+    for (unsigned i = 0; i < cSpinCnt + cYieldCnt; i++) {
+      if (pReady()) {
+        return true;
+      }
+      if (!lRing.mRunning || pTimeout == std::chrono::microseconds(0)) {
+        return pReady();
+      }
+
+      if (i < cSpinCnt) {
+        cpu_relax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+
+    const auto lDeadline = clock::now() + pTimeout;
+
+    std::unique_lock<std::mutex> lLock(lRing.mLock);
+    pParked.store(true, std::memory_order_relaxed);
+    // pairs with the fence in wake(): either the waker sees the parked flag, or we see the update
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    while (!pReady() && lRing.mRunning) {
+      if (pTimeout < std::chrono::microseconds(0)) {
+        lRing.mCond.wait_for(lLock, cParkSlice);
+      } else {
+        const auto lNow = clock::now();
+        if (lNow >= lDeadline) {
+          break;
+        }
+        lRing.mCond.wait_for(lLock, std::min<clock::duration>(cParkSlice, lDeadline - lNow));
+      }
+    }
+
+    pParked.store(false, std::memory_order_relaxed);
+    return pReady();
+  }
+
+  void wake(std::atomic_bool &pParked)
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pParked.load(std::memory_order_relaxed)) {
+      std::scoped_lock lLock(mImpl->mLock);
+      mImpl->mCond.notify_all();
+    }
+  }
+
+  std::unique_ptr<RingInternals> mImpl;
+};
+
 ///
 ///  Pipeline handler with input and output ConcurrentContainer queue/stack
 ///
+
+/// Behavior of a pipeline stage when its capacity limit is reached
+enum PipelineStagePolicy {
+  eStageBlock,        // block the producer until the stage has room
+  eStageDropOldest,   // drop the oldest queued element to make room
+  eStageDropNewest    // drop the element being queued
+};
+
 template <
   typename T,
   typename = std::enable_if_t<std::is_move_assignable<T>::value>>
 class IFifoPipeline
 {
+ private:
+  // queued element with its size and the time of the enqueue
+  struct StageEntry {
+    T mElem;
+    std::size_t mSize = 0;
+    std::chrono::steady_clock::time_point mQueuedAt;
+  };
+
  public:
   IFifoPipeline() = delete;
 
   IFifoPipeline(unsigned pNoStages)
     : mPipelineQueues(pNoStages),
+      mStages(pNoStages),
       mPipelinedSizeSamples(0)
   {
+    for (auto &lStage : mStages) {
+      lStage = std::make_unique<StageState>();
+    }
   }
 
   virtual ~IFifoPipeline() {}
@@ -226,15 +508,45 @@ class IFifoPipeline
     for (auto& lQueue : mPipelineQueues) {
       lQueue.stop();
     }
+
+    // wake up blocked producers
+    for (auto &lStage : mStages) {
+      std::scoped_lock lLock(lStage->mLock);
+      lStage->mCond.notify_all();
+    }
   }
 
   void clearPipeline()
   {
-    for (auto& lQueue : mPipelineQueues) {
-      lQueue.flush();
+    for (unsigned lStageIdx = 0; lStageIdx < mPipelineQueues.size(); lStageIdx++) {
+      auto &lStage = *mStages[lStageIdx];
+
+      std::scoped_lock lLock(lStage.mLock);
+      mPipelineQueues[lStageIdx].flush();
+      if (lStage.mBatch) {
+        lStage.mBatch->clear();
+      }
+      mPipelinedSize -= lStage.mCount;
+      lStage.mCount = 0;
+      lStage.mBytes = 0;
+      lStage.mCond.notify_all();
     }
   }
 
+  /// Limit the number of elements and bytes queued in the stage (0: not limited)
+  void setStageLimit(unsigned pStage, const std::size_t pMaxCount, const std::size_t pMaxBytes,
+    const PipelineStagePolicy pPolicy)
+  {
+    assert(pStage < mStages.size());
+    auto &lStage = *mStages[pStage];
+
+    std::scoped_lock lLock(lStage.mLock);
+    lStage.mMaxCount = pMaxCount;
+    lStage.mMaxBytes = pMaxBytes;
+    lStage.mPolicy = pPolicy;
+    lStage.mLimited = (pMaxCount > 0 || pMaxBytes > 0);
+  }
+
   template <typename... Args>
   bool queue(unsigned pStage, Args&&... args)
   {
@@ -244,8 +556,15 @@ class IFifoPipeline
 
     // NOTE: (lNextStage == mPipelineQueues.size()) is the drop queue
     if (lNextStage < mPipelineQueues.size()) {
+      T lElem(std::forward<Args>(args)...);
+      const auto lElemSize = getPipelineElementSize(lElem);
+
+      if (!admit(lNextStage, lElem, lElemSize)) {
+        return false;
+      }
+
       const auto lSize = ++mPipelinedSize;
-      mPipelineQueues[lNextStage].push(std::forward<Args>(args)...);
+      mPipelineQueues[lNextStage].push(StageEntry{ std::move(lElem), lElemSize, std::chrono::steady_clock::now() });
       mPipelinedSizeSamples.Fill(lSize);
       return true;
     }
@@ -254,28 +573,323 @@ class IFifoPipeline
 
   T dequeue(unsigned pStage)
   {
-    T t;
-    mPipelineQueues[pStage].pop(t);
+    StageEntry lEntry;
+    if (mPipelineQueues[pStage].pop(lEntry)) {
+      release(pStage, lEntry, true);
+    }
     mPipelinedSize--;
-    return t;
+    return std::move(lEntry.mElem);
   }
 
+  /// Consumer side buffer of a stage. The consumer blocks for the first element only, and takes the elements
+  /// already queued behind it with the same wake-up. Buffered elements are still accounted to the stage (limits,
+  /// depth and dwell time) until returned by next(), and the drop policies take them from the batch first.
+  /// next() returns an empty element when the stage is stopped, same as dequeue(). One batch per stage.
+  class StageBatch
+  {
+   public:
+    StageBatch(IFifoPipeline &pPipeline, unsigned pStage, const std::size_t pMaxCnt = cDequeueBatchSize)
+      : mPipeline(pPipeline),
+        mStage(pStage),
+        mMaxCnt(std::max(std::size_t(1), pMaxCnt))
+    {
+      mEntries.reserve(mMaxCnt);
+
+      auto &lStage = *mPipeline.mStages[mStage];
+      std::scoped_lock lLock(lStage.mLock);
+      assert(lStage.mBatch == nullptr);
+      lStage.mBatch = this;
+    }
+
+    ~StageBatch()
+    {
+      {
+        auto &lStage = *mPipeline.mStages[mStage];
+        std::scoped_lock lLock(lStage.mLock);
+        lStage.mBatch = nullptr;
+      }
+
+      // return the accounting of the unconsumed elements
+      for (; mIdx < mEntries.size(); mIdx++) {
+        mPipeline.release(mStage, mEntries[mIdx], false);
+        mPipeline.mPipelinedSize--;
+      }
+    }
+
+    T next()
+    {
+      StageEntry lEntry;
+
+      if (!take_front(lEntry)) {
+        // block for the first element only
+        if (!mPipeline.mPipelineQueues[mStage].pop(lEntry)) {
+          mPipeline.mPipelinedSize--; // same as dequeue() on a stopped stage
+          return T();
+        }
+
+        // take the elements queued behind it, without waiting
+        std::scoped_lock lLock(mLock);
+        mEntries.clear();
+        mIdx = 0;
+        mPipeline.mPipelineQueues[mStage].try_pop_n(mMaxCnt - 1, std::back_inserter(mEntries));
+      }
+
+      // NOTE: release() must not be called under the batch lock (lock order with admit())
+      mPipeline.release(mStage, lEntry, true);
+      mPipeline.mPipelinedSize--;
+      return std::move(lEntry.mElem);
+    }
+
+   private:
+    friend class IFifoPipeline;
+
+    // take the oldest buffered element. Used by the consumer and by the drop policies.
+    bool take_front(StageEntry &pEntry)
+    {
+      std::scoped_lock lLock(mLock);
+      if (mIdx == mEntries.size()) {
+        return false;
+      }
+      pEntry = std::move(mEntries[mIdx++]);
+      return true;
+    }
+
+    void clear()
+    {
+      std::scoped_lock lLock(mLock);
+      mEntries.clear();
+      mIdx = 0;
+    }
+
+    IFifoPipeline &mPipeline;
+    const unsigned mStage;
+    const std::size_t mMaxCnt;
+
+    std::mutex mLock;
+    std::vector<StageEntry> mEntries;
+    std::size_t mIdx = 0;
+  };
+
+  static constexpr std::size_t cDequeueBatchSize = 32;
+
+  /// Drop the oldest element of the stage
   bool try_pop(unsigned pStage)
   {
-    T t;
-    return mPipelineQueues[pStage].try_pop(t);
+    StageEntry lEntry;
+    {
+      std::scoped_lock lLock(mStages[pStage]->mLock);
+      if (!take_oldest(pStage, lEntry)) {
+        return false;
+      }
+    }
+
+    release(pStage, lEntry, false);
+    mPipelinedSize--;
+    return true;
   }
 
   long getPipelineSize() const noexcept { return mPipelinedSize; }
 
   const auto& getPipelinedSizeSamples() const noexcept { return mPipelinedSizeSamples; }
 
+  /// Number of elements dropped by the capacity limit of the stage
+  std::uint64_t getStageDropCount(unsigned pStage) const noexcept { return mStages[pStage]->mDropped; }
+
+  // dwell time histogram in microseconds. The last bucket is open (> 1 h)
+  static constexpr std::size_t cDwellBuckets = 33;
+  using DwellHistogram = Log2Histogram<cDwellBuckets>;
+
+  /// Stage occupancy and dwell time. Counters are totals since the start of the pipeline.
+  struct StageStats {
+    std::size_t mDepth = 0;           // queued elements
+    std::size_t mDepthBytes = 0;      // queued bytes
+    std::uint64_t mDequeued = 0;      // elements taken by the consumer
+    std::uint64_t mDequeuedBytes = 0; // bytes taken by the consumer
+    std::uint64_t mDropped = 0;       // elements dropped by the capacity limit
+    std::array<std::uint64_t, cDwellBuckets> mDwellHist = {}; // time spent in the stage (us)
+  };
+
+  StageStats getStageStats(unsigned pStage) const
+  {
+    assert(pStage < mStages.size());
+    const auto &lStage = *mStages[pStage];
+
+    StageStats lStats;
+    lStats.mDepth = lStage.mCount;
+    lStats.mDepthBytes = lStage.mBytes;
+    lStats.mDequeued = lStage.mDequeued;
+    lStats.mDequeuedBytes = lStage.mDequeuedBytes;
+    lStats.mDropped = lStage.mDropped;
+    lStats.mDwellHist = lStage.mDwellHist.Snapshot();
+    return lStats;
+  }
+
+  /// Log occupancy, dwell time and throughput of every stage. Throughput and dwell time quantiles (upper bucket
+  /// bounds) are measured since the previous call.
+  void logPipelineStats(const std::vector<std::string> &pStageNames)
+  {
+    const auto lNow = std::chrono::steady_clock::now();
+    const double lInterval = std::chrono::duration<double>(lNow - mLastStatsTime).count();
+    mLastStatsTime = lNow;
+
+    mLastStageStats.resize(mStages.size());
+
+    for (unsigned lStageIdx = 0; lStageIdx < mStages.size(); lStageIdx++) {
+      const auto lStats = getStageStats(lStageIdx);
+      auto &lLast = mLastStageStats[lStageIdx];
+
+      const double lRate = (lInterval > 0) ? double(lStats.mDequeued - lLast.mDequeued) / lInterval : 0.0;
+      const double lRateMiB = (lInterval > 0) ?
+        double(lStats.mDequeuedBytes - lLast.mDequeuedBytes) / lInterval / double(1 << 20) : 0.0;
+
+      // dwell time quantiles of the interval
+      auto lDwellHist = lStats.mDwellHist;
+      for (std::size_t i = 0; i < lDwellHist.size(); i++) {
+        lDwellHist[i] -= lLast.mDwellHist[i];
+      }
+
+      DDLOGF(fair::Severity::INFO, "Pipeline stage={} depth={} depth_bytes={} rate_hz={:.2f} rate_mibs={:.2f} "
+        "dwell_p50_us={} dwell_p99_us={} dropped={}",
+        (lStageIdx < pStageNames.size() ? pStageNames[lStageIdx] : std::to_string(lStageIdx)),
+        lStats.mDepth, lStats.mDepthBytes, lRate, lRateMiB,
+        DwellHistogram::Quantile(lDwellHist, 0.5), DwellHistogram::Quantile(lDwellHist, 0.99), lStats.mDropped);
+
+      lLast = lStats;
+    }
+  }
+
  protected:
   virtual unsigned getNextPipelineStage(unsigned pStage) = 0;
 
+  /// Size of the element in bytes, used for the byte limits of the stages
+  virtual std::size_t getPipelineElementSize(const T&) const { return 0; }
+
+  /// Called for every element dropped by the capacity limit of a stage
+  virtual void onPipelineDrop(unsigned /* pStage */, const T&) { }
+
   std::atomic_long mPipelinedSize = 0;
-  std::vector<o2::DataDistribution::ConcurrentFifo<T>> mPipelineQueues;
 
+ private:
+  std::vector<o2::DataDistribution::ConcurrentFifo<StageEntry>> mPipelineQueues;
+
+  struct StageState {
+    // limits and policy, guarded by mLock
+    bool mLimited = false;
+    std::size_t mMaxCount = 0;
+    std::size_t mMaxBytes = 0;
+    PipelineStagePolicy mPolicy = eStageBlock;
+
+    std::atomic_size_t mCount = 0;
+    std::atomic_size_t mBytes = 0;
+    std::atomic_uint64_t mDropped = 0;
+
+    // instrumentation
+    std::atomic_uint64_t mDequeued = 0;
+    std::atomic_uint64_t mDequeuedBytes = 0;
+    DwellHistogram mDwellHist;
+
+    std::atomic_uint mWaiters = 0;
+    std::mutex mLock;
+    std::condition_variable mCond;
+
+    // consumer batch of the stage (if any), guarded by mLock
+    StageBatch *mBatch = nullptr;
+
+    // NOTE: a single element larger than the byte limit is admitted into an empty stage
+    bool full(const std::size_t pElemSize) const {
+      return (mMaxCount > 0 && mCount + 1 > mMaxCount) ||
+        (mMaxBytes > 0 && mCount > 0 && mBytes + pElemSize > mMaxBytes);
+    }
+  };
+
+  // reserve the room for the element in the stage. Returns false if the element is dropped
+  bool admit(unsigned pStage, const T &pElem, const std::size_t pElemSize)
+  {
+    auto &lStage = *mStages[pStage];
+
+    // dropped elements are reported and destroyed after the stage lock is released
+    std::vector<T> lDropped;
+
+    std::unique_lock<std::mutex> lLock(lStage.mLock);
+
+    while (lStage.mLimited && lStage.full(pElemSize) && mPipelineQueues[pStage].is_running()) {
+
+      if (lStage.mPolicy == eStageDropNewest) {
+        lStage.mDropped++;
+        lLock.unlock();
+        onPipelineDrop(pStage, pElem);
+        return false;
+      }
+
+      if (lStage.mPolicy == eStageDropOldest) {
+        StageEntry lOldest;
+        if (!take_oldest(pStage, lOldest)) {
+          break; // the only element is being dequeued
+        }
+        lStage.mCount--;
+        lStage.mBytes -= lOldest.mSize;
+        lStage.mDropped++;
+        mPipelinedSize--;
+        lDropped.push_back(std::move(lOldest.mElem));
+        continue;
+      }
+
+      // eStageBlock: recheck after announcing the waiter, pairs with release()
+      lStage.mWaiters++;
+      if (lStage.full(pElemSize)) {
+        lStage.mCond.wait_for(lLock, std::chrono::milliseconds(100));
+      }
+      lStage.mWaiters--;
+    }
+
+    lStage.mCount++;
+    lStage.mBytes += pElemSize;
+    lLock.unlock();
+
+    for (const auto &lElem : lDropped) {
+      onPipelineDrop(pStage, lElem);
+    }
+    return true;
+  }
+
+  // take the oldest element of the stage: buffered in the consumer batch, then queued. Caller holds the stage lock.
+  // NOTE: lock order: stage -> batch -> queue
+  bool take_oldest(unsigned pStage, StageEntry &pEntry)
+  {
+    auto &lStage = *mStages[pStage];
+    if (lStage.mBatch && lStage.mBatch->take_front(pEntry)) {
+      return true;
+    }
+    return mPipelineQueues[pStage].try_pop(pEntry);
+  }
+
+  void release(unsigned pStage, const StageEntry &pEntry, const bool pDequeued)
+  {
+    auto &lStage = *mStages[pStage];
+
+    lStage.mCount--;
+    lStage.mBytes -= pEntry.mSize;
+
+    if (pDequeued) {
+      lStage.mDequeued.fetch_add(1, std::memory_order_relaxed);
+      lStage.mDequeuedBytes.fetch_add(pEntry.mSize, std::memory_order_relaxed);
+      lStage.mDwellHist.Fill(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - pEntry.mQueuedAt).count());
+    }
+
+    if (lStage.mWaiters > 0) {
+      std::scoped_lock lLock(lStage.mLock);
+      lStage.mCond.notify_all();
+    }
+  }
+
+  std::vector<std::unique_ptr<StageState>> mStages;
+
+  // used by logPipelineStats()
+  std::chrono::steady_clock::time_point mLastStatsTime = std::chrono::steady_clock::now();
+  std::vector<StageStats> mLastStageStats;
+
+ protected:
   RunningSamples<long> mPipelinedSizeSamples;
 };
 }
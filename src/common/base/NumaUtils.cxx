@@ -0,0 +1,136 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "NumaUtils.h"
+#include "DataDistLogger.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace o2
+{
+namespace DataDistribution
+{
+
+std::vector<int> NumaUtils::getNodeCpus(const int pNode)
+{
+  std::vector<int> lCpus;
+
+  // cpulist format: "0-15,32-47"
+  std::ifstream lCpuListFile("/sys/devices/system/node/node" + std::to_string(pNode) + "/cpulist");
+  std::string lCpuList;
+  if (!lCpuListFile || !std::getline(lCpuListFile, lCpuList)) {
+    return lCpus;
+  }
+
+  std::stringstream lRanges(lCpuList);
+  std::string lRange;
+  while (std::getline(lRanges, lRange, ',')) {
+    if (lRange.empty()) {
+      continue;
+    }
+
+    try {
+      const auto lDashPos = lRange.find('-');
+      const int lFirst = std::stoi(lRange.substr(0, lDashPos));
+      const int lLast = (lDashPos == std::string::npos) ? lFirst : std::stoi(lRange.substr(lDashPos + 1));
+
+      for (int lCpu = lFirst; lCpu <= lLast; lCpu++) {
+        lCpus.push_back(lCpu);
+      }
+    } catch (...) {
+      DDLOGF(fair::Severity::ERROR, "NUMA: cannot parse the cpu list of the node. node={} cpulist={}",
+        pNode, lCpuList);
+      return std::vector<int>();
+    }
+  }
+
+  return lCpus;
+}
+
+bool NumaUtils::nodeValid(const int pNode)
+{
+  return (pNode >= 0) && !getNodeCpus(pNode).empty();
+}
+
+bool NumaUtils::bindMemory(void *pAddr, const std::size_t pSize, const int pNode)
+{
+  static constexpr std::size_t cMaxNodes = 1024;
+  std::array<unsigned long, cMaxNodes / (8 * sizeof(unsigned long))> lNodeMask = { };
+
+  if (pNode < 0 || std::size_t(pNode) >= cMaxNodes) {
+    DDLOGF(fair::Severity::ERROR, "NUMA: invalid node for memory binding. node={}", pNode);
+    return false;
+  }
+
+  lNodeMask[pNode / (8 * sizeof(unsigned long))] |= 1UL << (pNode % (8 * sizeof(unsigned long)));
+
+  // mbind requires page aligned range
+  const std::size_t lPageSize = sysconf(_SC_PAGESIZE);
+  const auto lStart = reinterpret_cast<std::uintptr_t>(pAddr) / lPageSize * lPageSize;
+  const auto lEnd = (reinterpret_cast<std::uintptr_t>(pAddr) + pSize + lPageSize - 1) / lPageSize * lPageSize;
+
+  // NOTE: MPOL_PREFERRED does not fail allocations (SIGBUS) when the node is exhausted
+  // NOTE: maxnode is one larger than the mask, as expected by the kernel
+  const auto lRet = syscall(SYS_mbind, lStart, lEnd - lStart, MPOL_PREFERRED, lNodeMask.data(),
+    cMaxNodes + 1, MPOL_MF_MOVE);
+
+  if (lRet != 0) {
+    DDLOGF(fair::Severity::ERROR, "NUMA: binding memory to the node failed. node={} size={} error={}",
+      pNode, pSize, std::strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+bool NumaUtils::pinThread(const int pNode)
+{
+  const auto lCpus = getNodeCpus(pNode);
+  if (lCpus.empty()) {
+    DDLOGF(fair::Severity::ERROR, "NUMA: node does not exist or has no cpus. node={}", pNode);
+    return false;
+  }
+
+  cpu_set_t lCpuSet;
+  CPU_ZERO(&lCpuSet);
+  for (const auto lCpu : lCpus) {
+    if (lCpu < CPU_SETSIZE) {
+      CPU_SET(lCpu, &lCpuSet);
+    }
+  }
+
+  const auto lRet = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &lCpuSet);
+  if (lRet != 0) {
+    DDLOGF(fair::Severity::ERROR, "NUMA: pinning the thread to the node failed. node={} error={}",
+      pNode, std::strerror(lRet));
+    return false;
+  }
+
+  DDLOGF(fair::Severity::DEBUG, "NUMA: thread pinned to the node. node={} num_cpus={}", pNode, lCpus.size());
+  return true;
+}
+
+}
+} /* o2::DataDistribution */
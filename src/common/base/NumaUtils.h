@@ -0,0 +1,52 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef ALICEO2_DATADIST_NUMA_UTILS_H_
+#define ALICEO2_DATADIST_NUMA_UTILS_H_
+
+#include <vector>
+#include <cstddef>
+
+namespace o2
+{
+namespace DataDistribution
+{
+
+////////////////////////////////////////////////////////////////////////////////
+/// NumaUtils class
+////////////////////////////////////////////////////////////////////////////////
+
+class NumaUtils
+{
+ public:
+  NumaUtils() = delete;
+
+  /// no NUMA placement requested
+  static constexpr int cNoNode = -1;
+
+  /// check if the node exists and has CPUs
+  static bool nodeValid(const int pNode);
+
+  /// prefer memory from the node for the mapping. Already faulted pages are migrated.
+  static bool bindMemory(void *pAddr, const std::size_t pSize, const int pNode);
+
+  /// pin the calling thread to the CPUs of the node
+  static bool pinThread(const int pNode);
+
+ private:
+  static std::vector<int> getNodeCpus(const int pNode);
+};
+}
+} /* o2::DataDistribution */
+
+#endif /* ALICEO2_DATADIST_NUMA_UTILS_H_ */
@@ -21,7 +21,12 @@
 #include <thread>
 
 #include <array>
+#include <vector>
 #include <numeric>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
 
 namespace o2
 {
@@ -44,6 +49,199 @@ public:
   }
 };
 
+/// Lock-free histogram with power of two buckets. Bucket i counts values in [2^(i-1), 2^i),
+/// bucket 0 counts zeros, and the last bucket is open.
+template <size_t N>
+class Log2Histogram
+{
+ public:
+  static constexpr size_t cBuckets = N;
+
+  void Fill(const std::uint64_t pVal)
+  {
+    size_t lBucket = 0;
+    while (lBucket < N - 1 && (std::uint64_t(1) << lBucket) <= pVal) {
+      lBucket++;
+    }
+    mBuckets[lBucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::array<std::uint64_t, N> Snapshot() const
+  {
+    std::array<std::uint64_t, N> lRet;
+    for (size_t i = 0; i < N; i++) {
+      lRet[i] = mBuckets[i].load(std::memory_order_relaxed);
+    }
+    return lRet;
+  }
+
+  /// exclusive upper bound of the bucket
+  static constexpr std::uint64_t BucketLimit(const size_t pBucket) { return std::uint64_t(1) << pBucket; }
+
+  /// upper bound of the bucket containing the quantile (0 if empty)
+  static std::uint64_t Quantile(const std::array<std::uint64_t, N> &pSnapshot, const double pQuantile)
+  {
+    const auto lCount = std::accumulate(pSnapshot.begin(), pSnapshot.end(), std::uint64_t(0));
+    if (lCount == 0) {
+      return 0;
+    }
+
+    const auto lRank = std::uint64_t(pQuantile * double(lCount - 1));
+    std::uint64_t lSeen = 0;
+    for (size_t i = 0; i < N; i++) {
+      lSeen += pSnapshot[i];
+      if (lSeen > lRank) {
+        return BucketLimit(i);
+      }
+    }
+    return BucketLimit(N - 1);
+  }
+
+ private:
+  std::array<std::atomic_uint64_t, N> mBuckets = {};
+};
+
+/// Lock-free log-linear histogram (HDR style) with fixed memory footprint.
+/// Values below 2^S are counted exactly; above, every power of two range is split into 2^(S-1)
+/// linear sub-buckets, giving a relative error of at most 2^-(S-1).
+/// Fill() can be called concurrently from any thread. Window() returns the samples recorded since
+/// the previous call, which can be used for windowed quantiles and rates.
+template <unsigned S = 7>
+class PercentileHistogram
+{
+  static_assert(S >= 2 && S < 16, "PercentileHistogram: invalid sub-bucket precision");
+
+  static constexpr std::uint64_t cLinearCnt = std::uint64_t(1) << S;
+  static constexpr std::uint64_t cSubBucketCnt = std::uint64_t(1) << (S - 1);
+
+ public:
+  static constexpr size_t cBuckets = cLinearCnt + (64 - S) * cSubBucketCnt;
+
+  class Snapshot
+  {
+   public:
+    std::uint64_t Count() const { return mCount; }
+    double Mean() const { return mCount == 0 ? 0.0 : (double(mSum) / double(mCount)); }
+    /// window duration in seconds
+    double Duration() const { return mDuration; }
+    /// samples per second recorded in the window
+    double Rate() const { return mDuration > 0.0 ? (double(mCount) / mDuration) : 0.0; }
+
+    /// value of the quantile (representative value of the bucket, 0 if empty)
+    std::uint64_t Quantile(const double pQuantile) const
+    {
+      if (mCount == 0) {
+        return 0;
+      }
+
+      const auto lRank = std::uint64_t(pQuantile * double(mCount - 1));
+      std::uint64_t lSeen = 0;
+      for (size_t i = 0; i < mBuckets.size(); i++) {
+        lSeen += mBuckets[i];
+        if (lSeen > lRank) {
+          return BucketValue(i);
+        }
+      }
+      return BucketValue(mBuckets.size() - 1);
+    }
+
+   private:
+    friend class PercentileHistogram;
+
+    std::vector<std::uint64_t> mBuckets;
+    std::uint64_t mCount = 0;
+    std::uint64_t mSum = 0;
+    double mDuration = 0.0;
+  };
+
+  PercentileHistogram()
+    : mWindowStart(std::chrono::steady_clock::now())
+  {
+  }
+
+  void Fill(const std::uint64_t pVal)
+  {
+    mBuckets[BucketIndex(pVal)].fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(pVal, std::memory_order_relaxed);
+  }
+
+  /// cumulative snapshot since construction
+  Snapshot Total() const
+  {
+    Snapshot lRet;
+    read(lRet);
+    lRet.mDuration = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count();
+    return lRet;
+  }
+
+  /// snapshot of samples recorded since the previous call
+  Snapshot Window()
+  {
+    std::scoped_lock lLock(mWindowLock);
+
+    Snapshot lCurrent;
+    read(lCurrent);
+    const auto lNow = std::chrono::steady_clock::now();
+
+    Snapshot lRet = lCurrent;
+    if (!mWindowLast.mBuckets.empty()) {
+      for (size_t i = 0; i < cBuckets; i++) {
+        lRet.mBuckets[i] -= std::min(lRet.mBuckets[i], mWindowLast.mBuckets[i]);
+      }
+      lRet.mCount -= std::min(lRet.mCount, mWindowLast.mCount);
+      lRet.mSum -= std::min(lRet.mSum, mWindowLast.mSum);
+    }
+    lRet.mDuration = std::chrono::duration<double>(lNow - mWindowStart).count();
+
+    mWindowLast = std::move(lCurrent);
+    mWindowStart = lNow;
+    return lRet;
+  }
+
+  static constexpr size_t BucketIndex(const std::uint64_t pVal)
+  {
+    if (pVal < cLinearCnt) {
+      return size_t(pVal);
+    }
+    const unsigned lMsb = 63 - unsigned(__builtin_clzll(pVal));
+    const std::uint64_t lMant = pVal >> (lMsb - S + 1); // in [2^(S-1), 2^S)
+    return size_t(cLinearCnt + (lMsb - S) * cSubBucketCnt + (lMant - cSubBucketCnt));
+  }
+
+  /// midpoint of the value range counted by the bucket
+  static constexpr std::uint64_t BucketValue(const size_t pBucket)
+  {
+    if (pBucket < cLinearCnt) {
+      return pBucket;
+    }
+    const unsigned lMsb = unsigned((pBucket - cLinearCnt) / cSubBucketCnt) + S;
+    const std::uint64_t lMant = ((pBucket - cLinearCnt) % cSubBucketCnt) + cSubBucketCnt;
+    const unsigned lShift = lMsb - S + 1;
+    return (lMant << lShift) + ((std::uint64_t(1) << lShift) >> 1);
+  }
+
+ private:
+  void read(Snapshot &pSnap) const
+  {
+    // the count is derived from the buckets so quantiles stay consistent with concurrent fills
+    pSnap.mSum = mSum.load(std::memory_order_relaxed);
+    pSnap.mBuckets.resize(cBuckets);
+    pSnap.mCount = 0;
+    for (size_t i = 0; i < cBuckets; i++) {
+      pSnap.mBuckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+      pSnap.mCount += pSnap.mBuckets[i];
+    }
+  }
+
+  std::array<std::atomic_uint64_t, cBuckets> mBuckets = {};
+  std::atomic_uint64_t mSum = 0;
+  const std::chrono::steady_clock::time_point mStart = std::chrono::steady_clock::now();
+
+  std::mutex mWindowLock;
+  Snapshot mWindowLast;
+  std::chrono::steady_clock::time_point mWindowStart;
+};
+
 template <
   typename T,
   size_t N = 1024,
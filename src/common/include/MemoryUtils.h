@@ -22,15 +22,28 @@
 #include <fairmq/FairMQChannel.h>
 
 #include "DataDistLogger.h"
+#include "NumaUtils.h"
+#include "Utilities.h"
 
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <map>
+#include <set>
 #include <mutex>
+#include <condition_variable>
 #include <memory>
 #include <thread>
 #include <chrono>
+#include <fstream>
+#include <sstream>
 
 #include <sys/mman.h>
+#include <sys/vfs.h>
+#include <cctype>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 
 class DataHeader;
@@ -43,6 +56,390 @@ namespace DataDistribution
 
 static constexpr const char *ENV_SHM_PATH = "DATADIST_SHM_PATH";
 
+// allocation timeout: negative value waits until memory is available or the resource is stopped
+static constexpr std::chrono::microseconds cAllocWaitForever = std::chrono::microseconds(-1);
+// longest single wait on the reclaim condition, bounds reaction time to missed notifications
+static constexpr std::chrono::milliseconds cAllocWaitSlice = std::chrono::milliseconds(100);
+
+////////////////////////////////////////////////////////////////////////////////
+/// Region pre-faulting
+////////////////////////////////////////////////////////////////////////////////
+
+// pre-fault mode of new regions: none, parallel (default), background
+static constexpr const char *ENV_SHM_PREFAULT = "DATADIST_SHM_PREFAULT";
+// number of threads used for parallel pre-faulting (default: number of cores, max 16)
+static constexpr const char *ENV_SHM_PREFAULT_THREADS = "DATADIST_SHM_PREFAULT_THREADS";
+
+enum RegionPrefaultMode {
+  ePrefaultNone,        // pages are faulted in on first use. The region is not locked.
+  ePrefaultParallel,    // fill the region before it is used, on several threads, then lock it
+  ePrefaultBackground   // fault in the pages without modifying them, while the region is already used, then lock it
+};
+
+static inline
+RegionPrefaultMode getRegionPrefaultMode()
+{
+  const auto lModeStr = std::getenv(ENV_SHM_PREFAULT);
+  if (!lModeStr) {
+    return ePrefaultParallel;
+  }
+
+  const std::string lMode = lModeStr;
+  if (lMode == "none") {
+    return ePrefaultNone;
+  } else if (lMode == "parallel") {
+    return ePrefaultParallel;
+  } else if (lMode == "background") {
+    return ePrefaultBackground;
+  }
+
+  DDLOGF(fair::Severity::ERROR, "Unknown region pre-fault mode. Using 'parallel'. "
+    "Supported: none, parallel, background. {}={}", ENV_SHM_PREFAULT, lMode);
+  return ePrefaultParallel;
+}
+
+static inline
+const char* getRegionPrefaultModeName(const RegionPrefaultMode pMode)
+{
+  switch (pMode) {
+    case ePrefaultNone: return "none";
+    case ePrefaultParallel: return "parallel";
+    case ePrefaultBackground: return "background";
+  }
+  return "unknown";
+}
+
+/// Fill the memory with a pattern using several threads. Must not be used on memory in use.
+static inline
+void prefaultMemoryParallel(char *pStart, const std::size_t pSize, const int pPattern)
+{
+  static constexpr std::size_t cMinChunkSize = std::size_t(64) << 20;
+
+  unsigned lThreadCnt = std::clamp(std::thread::hardware_concurrency(), 1U, 16U);
+  if (const auto lThreadsStr = std::getenv(ENV_SHM_PREFAULT_THREADS)) {
+    lThreadCnt = std::clamp(std::atoi(lThreadsStr), 1, 256);
+  }
+  lThreadCnt = std::max(std::size_t(1), std::min(std::size_t(lThreadCnt), pSize / cMinChunkSize));
+
+  if (lThreadCnt == 1) {
+    std::memset(pStart, pPattern, pSize);
+    return;
+  }
+
+  // page aligned chunks, the last thread takes the remainder
+  const std::size_t lPageSize = sysconf(_SC_PAGESIZE);
+  const std::size_t lChunkSize = (pSize / lThreadCnt + lPageSize - 1) / lPageSize * lPageSize;
+
+  std::vector<std::thread> lThreads;
+  for (std::size_t lOff = 0; lOff < pSize; lOff += lChunkSize) {
+    const std::size_t lLen = std::min(lChunkSize, pSize - lOff);
+    lThreads.emplace_back([pStart, lOff, lLen, pPattern]() {
+      std::memset(pStart + lOff, pPattern, lLen);
+    });
+  }
+
+  for (auto &lThread : lThreads) {
+    lThread.join();
+  }
+}
+
+/// Fault in the pages without modifying the contents. Safe to run while the memory is in use.
+static inline
+void prefaultMemoryInPlace(char *pStart, const std::size_t pSize, const std::atomic_bool &pRunning)
+{
+  static constexpr std::size_t cStepSize = std::size_t(16) << 20;
+  const std::size_t lPageSize = sysconf(_SC_PAGESIZE);
+
+#if defined(MADV_POPULATE_WRITE)
+  bool lUseMadvise = true;
+#endif
+
+  for (std::size_t lOff = 0; lOff < pSize && pRunning; lOff += cStepSize) {
+    const std::size_t lLen = std::min(cStepSize, pSize - lOff);
+
+#if defined(MADV_POPULATE_WRITE)
+    if (lUseMadvise) {
+      if (0 == madvise(pStart + lOff, lLen, MADV_POPULATE_WRITE)) {
+        continue;
+      }
+      lUseMadvise = false; // not supported by the kernel
+    }
+#endif
+
+    // write fault without changing the value (memory can be concurrently used)
+    for (std::size_t lPage = 0; lPage < lLen; lPage += lPageSize) {
+      __atomic_fetch_or(pStart + lOff + lPage, char(0), __ATOMIC_RELAXED);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Region page size
+////////////////////////////////////////////////////////////////////////////////
+
+// huge pages of new regions: none (default), thp, 2M, 1G
+static constexpr const char *ENV_SHM_HUGEPAGES = "DATADIST_SHM_HUGEPAGES";
+
+enum RegionHugePageMode {
+  eHugePagesNone,         // default SHM mapping
+  eHugePagesTransparent,  // default SHM mapping, advised to use transparent huge pages
+  eHugePages2M,           // hugetlbfs mapping with 2 MiB pages
+  eHugePages1G            // hugetlbfs mapping with 1 GiB pages
+};
+
+#if !defined(HUGETLBFS_MAGIC)
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+
+static inline
+RegionHugePageMode getRegionHugePageMode()
+{
+  const auto lModeStr = std::getenv(ENV_SHM_HUGEPAGES);
+  if (!lModeStr) {
+    return eHugePagesNone;
+  }
+
+  const std::string lMode = lModeStr;
+  if (lMode == "none") {
+    return eHugePagesNone;
+  } else if (lMode == "thp") {
+    return eHugePagesTransparent;
+  } else if (lMode == "2M") {
+    return eHugePages2M;
+  } else if (lMode == "1G") {
+    return eHugePages1G;
+  }
+
+  DDLOGF(fair::Severity::ERROR, "Unknown region huge page mode. Not using huge pages. "
+    "Supported: none, thp, 2M, 1G. {}={}", ENV_SHM_HUGEPAGES, lMode);
+  return eHugePagesNone;
+}
+
+/// Page size of a hugetlbfs mount, or 0 if the path is not on hugetlbfs
+static inline
+std::size_t getHugetlbfsPageSize(const std::string &pPath)
+{
+  struct statfs lFsStat;
+  if (0 != statfs(pPath.c_str(), &lFsStat) || lFsStat.f_type != HUGETLBFS_MAGIC) {
+    return 0;
+  }
+  return lFsStat.f_bsize;
+}
+
+/// Find a writable hugetlbfs mount with the requested page size
+static inline
+std::string findHugetlbfsMount(const std::size_t pPageSize)
+{
+  std::ifstream lMounts("/proc/mounts");
+  std::string lLine;
+
+  while (std::getline(lMounts, lLine)) {
+    std::istringstream lMountEntry(lLine);
+    std::string lDevice, lMountPoint, lFsType;
+    if (!(lMountEntry >> lDevice >> lMountPoint >> lFsType) || lFsType != "hugetlbfs") {
+      continue;
+    }
+
+    if (getHugetlbfsPageSize(lMountPoint) == pPageSize && (0 == access(lMountPoint.c_str(), W_OK))) {
+      return lMountPoint;
+    }
+  }
+
+  return std::string();
+}
+
+/// Select the file mapping of a new region. Returns the segment root (empty for the default SHM)
+/// and the page size the region size should be aligned to.
+static inline
+std::string getRegionSegmentRoot(const RegionHugePageMode pMode, std::size_t &pPageSize)
+{
+  namespace bfs = boost::filesystem;
+  std::string lSegmentRoot;
+
+  pPageSize = sysconf(_SC_PAGESIZE);
+
+  // try to use different file mapping (hugetlbfs)
+  const auto lHugetlbfsPath = std::getenv(ENV_SHM_PATH);
+  if (lHugetlbfsPath) {
+    do {
+      // make sure directory exists
+      bfs::path lDirPath(lHugetlbfsPath);
+      if (!bfs::is_directory(lDirPath)) {
+        DDLOGF(fair::Severity::ERROR, "Hugetlbfs mountpoint does not exist. Not using huge pages. {}={}",
+          ENV_SHM_PATH, lHugetlbfsPath);
+        break;
+      }
+
+      // check if the hugetlbs is writeable
+      if (0 != access(lHugetlbfsPath, W_OK)) {
+        DDLOGF(fair::Severity::ERROR, "Hugetlbfs mountpoint is not writeable. "
+          "Make sure the permissions are properly set. {}={}", ENV_SHM_PATH, lHugetlbfsPath);
+        break;
+      }
+
+      lSegmentRoot = lHugetlbfsPath;
+      lSegmentRoot += bfs::path::preferred_separator;
+      pPageSize = std::max(pPageSize, getHugetlbfsPageSize(lHugetlbfsPath));
+      return lSegmentRoot;
+    } while (false);
+  }
+
+  switch (pMode) {
+    case eHugePagesNone:
+      break;
+    case eHugePagesTransparent:
+      // NOTE: only used for alignment. Mapping is advised after the region is created.
+      pPageSize = std::size_t(2) << 20;
+      break;
+    case eHugePages2M:
+    case eHugePages1G:
+    {
+      const std::size_t lHugePageSize = (pMode == eHugePages2M) ? (std::size_t(2) << 20) : (std::size_t(1) << 30);
+      const auto lMountPoint = findHugetlbfsMount(lHugePageSize);
+      if (lMountPoint.empty()) {
+        DDLOGF(fair::Severity::ERROR, "No writable hugetlbfs mount with the requested page size. "
+          "Not using huge pages. page_size={} {}={}", lHugePageSize, ENV_SHM_HUGEPAGES, std::getenv(ENV_SHM_HUGEPAGES));
+        break;
+      }
+
+      lSegmentRoot = lMountPoint;
+      lSegmentRoot += bfs::path::preferred_separator;
+      pPageSize = lHugePageSize;
+      break;
+    }
+  }
+
+  return lSegmentRoot;
+}
+
+/// Advise transparent huge pages for the region. Must be called before the memory is touched.
+static inline
+void adviseTransparentHugePages(void *pAddr, const std::size_t pSize)
+{
+#if defined(MADV_HUGEPAGE)
+  if (0 != madvise(pAddr, pSize, MADV_HUGEPAGE)) {
+    DDLOGF(fair::Severity::ERROR, "Transparent huge pages are not available for the region. error={}",
+      std::strerror(errno));
+  }
+
+  std::ifstream lShmemThp("/sys/kernel/mm/transparent_hugepage/shmem_enabled");
+  std::string lShmemThpMode;
+  if (std::getline(lShmemThp, lShmemThpMode) &&
+    (lShmemThpMode.find("[never]") != std::string::npos || lShmemThpMode.find("[deny]") != std::string::npos)) {
+    DDLOGF(fair::Severity::WARNING, "Transparent huge pages are disabled for shared memory. "
+      "Set /sys/kernel/mm/transparent_hugepage/shmem_enabled to 'advise'. current={}", lShmemThpMode);
+  }
+#else
+  (void) pAddr; (void) pSize;
+  DDLOGF(fair::Severity::ERROR, "Transparent huge pages are not supported.");
+#endif
+}
+
+/// Lock the memory of a region (regions are mapped without MAP_LOCKED). Faults in the pages that are not yet mapped.
+static inline
+void lockRegionMemory(void *pAddr, const std::size_t pSize)
+{
+  if (0 != mlock(pAddr, pSize)) {
+    DDLOGF(fair::Severity::WARNING, "Cannot lock the region memory. size={} error={}", pSize, std::strerror(errno));
+  }
+}
+
+/// Page size backing the mapping at the address, and the number of bytes mapped with huge PMD entries (THP)
+static inline
+std::size_t getMappingPageSize(const void *pAddr, std::size_t &pPmdMappedBytes)
+{
+  const auto lAddr = reinterpret_cast<std::uintptr_t>(pAddr);
+  std::size_t lPageSize = 0;
+  pPmdMappedBytes = 0;
+
+  std::ifstream lSmaps("/proc/self/smaps");
+  std::string lLine;
+  bool lInMapping = false;
+
+  while (std::getline(lSmaps, lLine)) {
+    // mapping header: "start-end perms offset dev inode path"
+    const auto lDashPos = lLine.find('-');
+    const auto lSpacePos = lLine.find(' ');
+    if (lDashPos != std::string::npos && lSpacePos != std::string::npos && lDashPos < lSpacePos &&
+      std::isxdigit(static_cast<unsigned char>(lLine[0]))) {
+      if (lInMapping) {
+        break;
+      }
+
+      const auto lStart = std::stoull(lLine.substr(0, lDashPos), nullptr, 16);
+      const auto lEnd = std::stoull(lLine.substr(lDashPos + 1, lSpacePos - lDashPos - 1), nullptr, 16);
+      lInMapping = (lAddr >= lStart && lAddr < lEnd);
+      continue;
+    }
+
+    if (!lInMapping) {
+      continue;
+    }
+
+    std::istringstream lField(lLine);
+    std::string lKey;
+    std::size_t lValue = 0;
+    lField >> lKey >> lValue;
+
+    if (lKey == "KernelPageSize:") {
+      lPageSize = lValue << 10;
+    } else if (lKey == "ShmemPmdMapped:" || lKey == "FilePmdMapped:" || lKey == "AnonHugePages:") {
+      pPmdMappedBytes += lValue << 10;
+    }
+  }
+
+  return lPageSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Region telemetry
+////////////////////////////////////////////////////////////////////////////////
+
+/// Histogram of allocation stall times, in power of two microsecond buckets (last bucket > 8 s)
+using AllocStallHistogram = Log2Histogram<24>;
+
+/// Snapshot of the region counters
+struct RegionStats {
+  std::string mName;
+  std::size_t mSize = 0;          // region size
+  std::size_t mUsed = 0;          // bytes allocated and not yet returned by the transport
+  std::size_t mHighWater = 0;     // largest mUsed observed
+  std::size_t mLargestFree = 0;   // largest free extent
+  std::size_t mFreeExtents = 0;   // number of free extents
+  std::size_t mSlabSize = 0;      // bytes reserved for small object slabs
+  std::uint64_t mFallbackCnt = 0; // allocations served from the global SHM segment
+  std::uint64_t mStallCnt = 0;    // allocations that had to wait for free memory
+  std::array<std::uint64_t, AllocStallHistogram::cBuckets> mStallHist = {};
+};
+
+/// Raise the high-water mark to pValue
+static inline
+void updateHighWater(std::atomic_size_t &pHighWater, const std::size_t pValue)
+{
+  auto lPrev = pHighWater.load(std::memory_order_relaxed);
+  while (lPrev < pValue && !pHighWater.compare_exchange_weak(lPrev, pValue, std::memory_order_relaxed)) { }
+}
+
+static inline
+void logRegionStats(const RegionStats &pStats)
+{
+  std::string lStalls;
+  for (std::size_t i = 0; i < pStats.mStallHist.size(); i++) {
+    if (pStats.mStallHist[i] > 0) {
+      if (i < pStats.mStallHist.size() - 1) {
+        lStalls += fmt::format("<{}us:{} ", AllocStallHistogram::BucketLimit(i), pStats.mStallHist[i]);
+      } else {
+        lStalls += fmt::format(">={}us:{} ", AllocStallHistogram::BucketLimit(i - 1), pStats.mStallHist[i]);
+      }
+    }
+  }
+
+  DDLOGF(fair::Severity::INFO, "Region name={} size={} used={} high_water={} largest_free={} free_extents={} "
+    "slab_size={} fallback_allocations={} stalls={} stall_hist=[{}]", pStats.mName, pStats.mSize, pStats.mUsed,
+    pStats.mHighWater, pStats.mLargestFree, pStats.mFreeExtents, pStats.mSlabSize, pStats.mFallbackCnt,
+    pStats.mStallCnt, lStalls);
+}
+
 class FMQUnsynchronizedPoolMemoryResource
 {
 
@@ -50,46 +447,30 @@ public:
   FMQUnsynchronizedPoolMemoryResource() = delete;
 
   FMQUnsynchronizedPoolMemoryResource(std::string pSegmentName, FairMQChannel &pChan,
-                                      const std::size_t pSize, const std::size_t pObjSize,
-                                      std::uint64_t pRegionFlags = 0)
+                                      std::size_t pSize, const std::size_t pObjSize,
+                                      std::uint64_t pRegionFlags = 0,
+                                      const int pNumaNode = NumaUtils::cNoNode,
+                                      const bool pSliced = false)
   : mSegmentName(pSegmentName),
     mChan(pChan),
     mObjectSize(pObjSize)//,
     // mAlignedSize((pObjSize + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t))
   {
-    int lMapFlags = 0;
-    std::string lSegmentRoot = "";
-
-    // don't reserve swap space and try to lock the region
-#if defined(MAP_NORESERVE) && defined(MAP_LOCKED)
-    lMapFlags = MAP_NORESERVE | MAP_LOCKED;
-#endif
-
-    // try to use different file mapping (hugetlbfs)
-    const auto lHugetlbfsPath = std::getenv(ENV_SHM_PATH);
-    if (lHugetlbfsPath) {
-      do {
-        // make sure directory exists
-        namespace bfs = boost::filesystem;
-        bfs::path lDirPath(lHugetlbfsPath);
-        if (!bfs::is_directory(lDirPath)) {
-          DDLOGF(fair::Severity::ERROR, "Hugetlbfs mountpoint does not exist. Not using huge pages. {}={}",
-            ENV_SHM_PATH, lHugetlbfsPath);
-          break;
-        }
+    // select the mapping: default SHM, hugetlbfs, or transparent huge pages
+    const auto lHugePageMode = getRegionHugePageMode();
+    std::size_t lPageSize = 0;
+    const std::string lSegmentRoot = getRegionSegmentRoot(lHugePageMode, lPageSize);
+    pSize = (pSize + lPageSize - 1) / lPageSize * lPageSize;
 
-        // check if the hugetlbs is writeable
-        if (0 != access(lHugetlbfsPath, W_OK)) {
-          DDLOGF(fair::Severity::ERROR, "Hugetlbfs mountpoint is not writeable. "
-            "Make sure the permissions are properly set. {}={}", ENV_SHM_PATH, lHugetlbfsPath);
-          break;
-        }
+    const bool lThp = (lHugePageMode == eHugePagesTransparent) && lSegmentRoot.empty();
 
-        lSegmentRoot = lHugetlbfsPath;
-        lSegmentRoot += bfs::path::preferred_separator;
-      } while (false);
-    }
+    int lMapFlags = 0;
 
+    // don't reserve swap space. NOTE: MAP_LOCKED is not used: it faults in all pages on this thread at mmap
+    // time. The region is locked after it is pre-faulted (see lockRegionMemory()).
+#if defined(MAP_NORESERVE)
+    lMapFlags = MAP_NORESERVE;
+#endif
 
     DDLOGF(fair::Severity::INFO, "Creating new UnmanagedRegion name={} path={} size={} channel={}",
       mSegmentName, lSegmentRoot, pSize, pChan.GetName());
@@ -99,14 +480,42 @@ public:
       pRegionFlags,
       [this](const std::vector<FairMQRegionBlock>& pBlkVect) {
         // callback to be called when message buffers no longer needed by transport
-        std::scoped_lock lock(mReclaimLock);
-
         if (!mRunning) {
           return;
         }
 
+        // link the whole batch locally, then publish it with a single CAS
+        FreeObject *lFirst = nullptr;
+        FreeObject *lLast = nullptr;
+        std::size_t lCnt = 0;
+
         for (const auto &lBlk : pBlkVect) {
-          reclaimSHMMessage(lBlk.ptr, lBlk.size);
+          void *lObjPtr = lBlk.ptr;
+
+          if (mSliceRefs) {
+            // slice of an object: the object is free when its last reference is dropped
+            const auto lIdx = objectIndex(lBlk.ptr);
+            if (mSliceRefs[lIdx].fetch_sub(1, std::memory_order_acq_rel) != 1) {
+              continue;
+            }
+            lObjPtr = objectPtr(lIdx);
+          } else {
+            (void) lBlk.size;
+            assert (lBlk.size == mObjectSize);
+          }
+
+          auto *lObj = static_cast<FreeObject*>(lObjPtr);
+          lObj->mNext = lFirst;
+          lFirst = lObj;
+          if (!lLast) {
+            lLast = lObj;
+          }
+          lCnt++;
+        }
+
+        if (lFirst) {
+          reclaimSHMMessages(lFirst, lLast, lCnt);
+          notifyReclaim();
         }
       },
       lSegmentRoot.c_str(),
@@ -121,13 +530,49 @@ public:
 
     // prepare header pointers
     unsigned char* lObj = static_cast<unsigned char*>(mRegion->GetData());
-    memset(lObj, 0xAA, mRegion->GetSize());
 
-    const std::size_t lObjectCnt = mRegion->GetSize() / mObjectSize;
+    // NUMA placement and huge page advice. The region is mapped without MAP_LOCKED and not touched yet,
+    // so the pages are placed on the node when they are first faulted in (no migration is needed).
+    if (pNumaNode != NumaUtils::cNoNode) {
+      NumaUtils::bindMemory(lObj, mRegion->GetSize(), pNumaNode);
+    }
+    if (lThp) {
+      adviseTransparentHugePages(lObj, mRegion->GetSize());
+    }
+
+    // NOTE: linking of free objects below touches all pages, background pre-fault is not needed
+    const auto lSetupStart = std::chrono::steady_clock::now();
+    const auto lPrefaultMode = getRegionPrefaultMode();
+    if (lPrefaultMode == ePrefaultParallel) {
+      prefaultMemoryParallel(reinterpret_cast<char*>(lObj), mRegion->GetSize(), 0xAA);
+    }
+
+    // free objects are linked through their own memory
+    static_assert(alignof(FreeObject) <= sizeof(max_align_t));
+    assert(mObjectSize >= sizeof(FreeObject) && (mObjectSize % alignof(FreeObject) == 0));
 
-    for (std::size_t i = 0; i < lObjectCnt; i++) {
-      mAvailableObjects.push_back(lObj + i * mObjectSize);
+    mObjectCnt = mRegion->GetSize() / mObjectSize;
+
+    if (pSliced) {
+      mSliceRefs = std::make_unique<std::atomic_uint32_t[]>(mObjectCnt);
+    }
+
+    for (std::size_t i = mObjectCnt; i > 0; i--) {
+      auto *lFreeObj = reinterpret_cast<FreeObject*>(lObj + (i - 1) * mObjectSize);
+      lFreeObj->mNext = mAvailableObjects;
+      mAvailableObjects = lFreeObj;
     }
+
+    // all pages were touched by linking the objects
+    lockRegionMemory(lObj, mRegion->GetSize());
+
+    std::size_t lPmdMapped = 0;
+    mPageSize = getMappingPageSize(lObj, lPmdMapped);
+
+    DDLOGF(fair::Severity::INFO, "UnmanagedRegion setup done. name={} size={} prefault={} page_size={} "
+      "thp_mapped={} setup_ms={:.2f}", mSegmentName, mRegion->GetSize(), getRegionPrefaultModeName(lPrefaultMode),
+      mPageSize, lPmdMapped,
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lSetupStart).count());
   }
 
   std::unique_ptr<FairMQMessage> NewFairMQMessage(const std::size_t pSize=0) {
@@ -141,15 +586,54 @@ public:
     if (lMem != nullptr) {
       return mChan.NewMessage(mRegion, lMem, mObjectSize);
     } else {
-      // Log warning to increase the pool size
-      static thread_local unsigned throttle = 0;
-      if (++throttle > (1U << 18)) {
-       DDLOG(fair::Severity::WARNING) << "Header pool exhausted. Allocating from the global SHM pool.";
-        throttle = 0;
-      }
+      return NewFallbackMessage();
+    }
+  }
 
-      return mChan.NewMessage(mObjectSize);
+  // Allocate from the global SHM segment when the pool is exhausted. Fallback allocations are counted.
+  // Size 0: size of the pool object
+  std::unique_ptr<FairMQMessage> NewFallbackMessage(const std::size_t pSize = 0) {
+    // Log warning to increase the pool size
+    if (mFallbackCnt++ % 1024 == 0) {
+      DDLOGF(fair::Severity::WARNING, "Header pool exhausted. Allocating from the global SHM pool. "
+        "segment={} fallback_allocations={}", mSegmentName, mFallbackCnt.load());
     }
+
+    return mChan.NewMessage(pSize > 0 ? pSize : mObjectSize);
+  }
+
+  std::uint64_t fallbackCount() const { return mFallbackCnt; }
+
+  // A timed allocation found no free object, and no object was returned since. Callers should not wait again.
+  bool exhausted() const { return mExhausted.load(std::memory_order_relaxed); }
+
+  // Free objects are reported as free extents of object size
+  RegionStats stats() const {
+    RegionStats lStats;
+    lStats.mName = mSegmentName;
+    lStats.mSize = mRegion->GetSize();
+    lStats.mUsed = mUsedObjects.load(std::memory_order_relaxed) * mObjectSize;
+    lStats.mHighWater = mHighWaterObjects.load(std::memory_order_relaxed) * mObjectSize;
+    lStats.mFreeExtents = mObjectCnt - std::min(mObjectCnt, mUsedObjects.load(std::memory_order_relaxed));
+    lStats.mLargestFree = lStats.mFreeExtents > 0 ? mObjectSize : 0;
+    lStats.mFallbackCnt = mFallbackCnt;
+    lStats.mStallCnt = mStallCnt;
+    lStats.mStallHist = mStallHist.Snapshot();
+    return lStats;
+  }
+
+  // Non-blocking allocation: returns nullptr if the pool is exhausted
+  std::unique_ptr<FairMQMessage> TryNewFairMQMessage() {
+    return NewFairMQMessageWaitFor(std::chrono::microseconds(0));
+  }
+
+  // Wait at most pTimeout for a free object: returns nullptr on timeout or if the pool is stopped
+  std::unique_ptr<FairMQMessage> NewFairMQMessageWaitFor(const std::chrono::microseconds &pTimeout) {
+    const auto lMem = do_allocate(mObjectSize, 0, pTimeout);
+    if (!lMem) {
+      return nullptr;
+    }
+    return mChan.NewMessage(mRegion, lMem, mObjectSize);
   }
 
   std::unique_ptr<FairMQMessage> NewFairMQMessageFromPtr(void *pPtr) {
@@ -160,85 +644,200 @@ public:
 
   std::size_t objectSize() const { return mObjectSize; }
 
+  /// Sliced pools: messages are created for parts (slices) of a pool object. The object is returned
+  /// to the pool when the owner released it and all slice messages are freed.
+  bool sliced() const { return bool(mSliceRefs); }
+
+  /// Take one object to be sliced. The caller owns one reference until ReleaseSliceObject().
+  void* NewSliceObjectWaitFor(const std::chrono::microseconds &pTimeout) {
+    assert(sliced());
+    auto lObj = do_allocate(mObjectSize, 0, pTimeout);
+    if (lObj) {
+      mSliceRefs[objectIndex(lObj)].store(1, std::memory_order_relaxed);
+    }
+    return lObj;
+  }
+
+  std::unique_ptr<FairMQMessage> NewSliceMessage(void *pObj, const std::size_t pOffset, const std::size_t pSize) {
+    assert(sliced() && (pOffset + pSize <= mObjectSize));
+    mSliceRefs[objectIndex(pObj)].fetch_add(1, std::memory_order_relaxed);
+    return mChan.NewMessage(mRegion, static_cast<char*>(pObj) + pOffset, pSize);
+  }
+
+  void ReleaseSliceObject(void *pObj) {
+    assert(sliced());
+    if (mSliceRefs[objectIndex(pObj)].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      auto *lObj = static_cast<FreeObject*>(pObj);
+      reclaimSHMMessages(lObj, lObj, 1);
+      notifyReclaim();
+    }
+  }
+
+  /// Page size backing the region, as reported by the kernel
+  std::size_t pageSize() const { return mPageSize; }
+
   inline void stop() {
-    std::scoped_lock lock(mReclaimLock);
     mRunning = false;
+
+    // wake up the allocating threads
+    std::scoped_lock lLock(mDepotLock);
+    mReclaimCond.notify_all();
   }
 
 protected:
-  void* do_allocate(std::size_t , std::size_t)
+  friend class FMQPoolMagazine;
+
+  // Free objects are kept in intrusive singly-linked lists, stored in the object memory itself
+  struct FreeObject {
+    FreeObject *mNext;
+  };
+
+  void* do_allocate(std::size_t , std::size_t, const std::chrono::microseconds &pTimeout = cAllocWaitForever)
   {
+    std::size_t lCnt;
+    auto lRet = take_objects(1, lCnt, pTimeout);
+
+    if (lRet) {
+      std::memset(lRet, 0, mObjectSize);
+    }
+
+    return lRet;
+  }
+
+  void do_deallocate(void *, std::size_t, std::size_t)
+  {
+    // Objects are only freed through SHM message reclaim callback.
+    // This is intentionally noop
+    // NOTE: handled in reclaimSHMMessage()
+  }
+
+  // Take up to pMax free objects as a null terminated list. Waits at most pTimeout if the pool is empty.
+  FreeObject* take_objects(const std::size_t pMax, std::size_t &pCnt, const std::chrono::microseconds &pTimeout)
+  {
+    pCnt = 0;
+
     if (!mRunning) {
       return nullptr;
     }
 
-    unsigned long lAllocAttempt = 0;
+    std::unique_lock<std::mutex> lLock(mDepotLock);
 
-    auto lRet = try_alloc();
-    // we cannot fail! report problem if failing to allocate block often
-    while (!lRet && mRunning) {
-      // try to reclaim if possible
-      try_reclaim();
-      // try again
-      lRet = try_alloc();
+    if (!mAvailableObjects && !try_reclaim() && pTimeout != std::chrono::microseconds(0)) {
+      const auto lWaitStart = std::chrono::steady_clock::now();
+      wait_reclaim(lLock, pTimeout);
+      mStallCnt++;
+      mStallHist.Fill(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - lWaitStart).count());
+    }
+
+    if (!mAvailableObjects) {
+      return nullptr;
+    }
 
-      if (!lRet) {
-        using namespace std::chrono_literals;
-        std::this_thread::sleep_for(1ms);
+    FreeObject *lFirst = mAvailableObjects;
+    FreeObject *lLast = lFirst;
+    pCnt = 1;
 
-        if (++lAllocAttempt % 512 == 0) {
-          DDLOGF(fair::Severity::WARNING,
-            "FMQUnsynchronizedPoolMemoryResource: failing to allocate free block of {} B, total region size: {} B",
-            mObjectSize, mRegion->GetSize());
-          DDLOGF(fair::Severity::WARNING, "Memory segment '{}' too small or large back-pressure.", mSegmentName);
-        }
-      }
+    while (pCnt < pMax && lLast->mNext) {
+      lLast = lLast->mNext;
+      pCnt++;
     }
 
-    assert (lRet);
-    std::memset(lRet, 0, mObjectSize);
+    mAvailableObjects = lLast->mNext;
+    lLast->mNext = nullptr;
 
-    return lRet;
+    updateHighWater(mHighWaterObjects, mUsedObjects.fetch_add(pCnt, std::memory_order_relaxed) + pCnt);
+
+    return lFirst;
   }
 
-  void do_deallocate(void *, std::size_t, std::size_t)
+  void reclaimSHMMessages(FreeObject *pFirst, FreeObject *pLast, const std::size_t pCnt)
   {
-    // Objects are only freed through SHM message reclaim callback.
-    // This is intentionally noop
-    // NOTE: handled in reclaimSHMMessage()
+    mUsedObjects.fetch_sub(pCnt, std::memory_order_relaxed);
+
+    // multiple producers: push the pre-linked batch [pFirst, pLast] on top of the reclaim stack
+    FreeObject *lHead = mReclaimedObjects.load(std::memory_order_relaxed);
+    do {
+      pLast->mNext = lHead;
+    } while (!mReclaimedObjects.compare_exchange_weak(lHead, pFirst,
+      std::memory_order_release, std::memory_order_relaxed));
+
+    if (mExhausted.load(std::memory_order_relaxed)) {
+      mExhausted.store(false, std::memory_order_relaxed);
+    }
   }
 
 private:
 
-  void* try_alloc() {
+  std::size_t objectIndex(const void *pPtr) const {
+    return (static_cast<const char*>(pPtr) - static_cast<const char*>(mRegion->GetData())) / mObjectSize;
+  }
 
-    if (!mAvailableObjects.empty()) {
-      auto lObjectPtr = mAvailableObjects.back();
-      mAvailableObjects.pop_back();
+  void* objectPtr(const std::size_t pIdx) const {
+    return static_cast<char*>(mRegion->GetData()) + pIdx * mObjectSize;
+  }
 
-      return lObjectPtr;
+  // wake up the allocating threads if waiting for free objects
+  void notifyReclaim() {
+    if (mAllocWaiters > 0) {
+      std::scoped_lock lLock(mDepotLock);
+      mReclaimCond.notify_all();
     }
-
-    return nullptr;
   }
 
+  // called with mDepotLock held
   bool try_reclaim() {
 
-    std::scoped_lock lock(mReclaimLock);
-
-    assert(mAvailableObjects.empty());
+    assert(mAvailableObjects == nullptr);
 
-    mAvailableObjects = std::move(mReclaimedObjects);
-    mReclaimedObjects.clear();
+    // take all reclaimed objects at once. The consumer never pops single nodes, so no ABA problem
+    mAvailableObjects = mReclaimedObjects.exchange(nullptr, std::memory_order_acquire);
 
-    return !mAvailableObjects.empty();
+    return (mAvailableObjects != nullptr);
   }
 
-  void reclaimSHMMessage(void* pData, size_t pSize)
+  // called with mDepotLock held
+  bool wait_reclaim(std::unique_lock<std::mutex> &pLock, const std::chrono::microseconds &pTimeout)
   {
-    (void) pSize;
-    assert (pSize == mObjectSize);
-    mReclaimedObjects.push_back(pData);
+    using namespace std::chrono_literals;
+    using clock = std::chrono::steady_clock;
+
+    const auto lWaitStart = clock::now();
+    auto lLastWarning = lWaitStart;
+
+    mAllocWaiters++;
+
+    while (mRunning && !mAvailableObjects) {
+      // NOTE: reclaim is checked after mAllocWaiters is set, so the notification cannot be missed
+      if (try_reclaim()) {
+        break;
+      }
+
+      const auto lNow = clock::now();
+      const auto lWaited = std::chrono::duration_cast<std::chrono::microseconds>(lNow - lWaitStart);
+      if (pTimeout >= 0us && lWaited >= pTimeout) {
+        mExhausted.store(true, std::memory_order_relaxed);
+        break;
+      }
+
+      if (lNow - lLastWarning >= 1s) {
+        lLastWarning = lNow;
+        DDLOGF(fair::Severity::WARNING,
+          "FMQUnsynchronizedPoolMemoryResource: waiting for free block of {} B, total region size: {} B, waited: {} ms",
+          mObjectSize, mRegion->GetSize(), std::chrono::duration_cast<std::chrono::milliseconds>(lWaited).count());
+        DDLOGF(fair::Severity::WARNING, "Memory segment '{}' too small or large back-pressure.", mSegmentName);
+      }
+
+      auto lWaitFor = std::chrono::duration_cast<std::chrono::microseconds>(cAllocWaitSlice);
+      if (pTimeout >= 0us) {
+        lWaitFor = std::min(lWaitFor, pTimeout - lWaited);
+      }
+
+      mReclaimCond.wait_for(pLock, lWaitFor);
+    }
+
+    mAllocWaiters--;
+    return (mAvailableObjects != nullptr);
   }
 
   /// fields
@@ -249,12 +848,110 @@ private:
 
   std::unique_ptr<FairMQUnmanagedRegion> mRegion;
   std::size_t mObjectSize;
+  std::size_t mPageSize = 0;
 
-  std::vector<void*> mAvailableObjects;
-  std::mutex mReclaimLock;
+  // shared free objects, refilled from mReclaimedObjects when empty
+  std::mutex mDepotLock;
+  FreeObject *mAvailableObjects = nullptr; // guarded by mDepotLock
 
-  // two step reclaim to avoid lock contention in the allocation path
-  std::vector<void*> mReclaimedObjects;
+  // two step reclaim without locks: region callbacks push (MPSC), allocating threads take all
+  std::atomic<FreeObject*> mReclaimedObjects = nullptr;
+
+  // sliced pools: references of each object (owner and slice messages)
+  std::unique_ptr<std::atomic_uint32_t[]> mSliceRefs;
+
+  // signalling of free objects, only used when the pool is exhausted
+  std::atomic_uint mAllocWaiters = 0;
+  std::condition_variable mReclaimCond;
+
+  // allocations served from the global SHM segment
+  std::atomic_uint64_t mFallbackCnt = 0;
+  std::atomic_bool mExhausted = false; // set on an allocation timeout, cleared when objects are returned
+
+  // telemetry: objects taken from the pool (including the ones cached in magazines)
+  std::size_t mObjectCnt = 0;
+  std::atomic_size_t mUsedObjects = 0;
+  std::atomic_size_t mHighWaterObjects = 0;
+  std::atomic_uint64_t mStallCnt = 0;
+  AllocStallHistogram mStallHist;
+};
+
+/// Per-thread cache of free objects of a shared FMQUnsynchronizedPoolMemoryResource.
+/// Allocations from the magazine do not touch any shared state. An empty magazine is
+/// refilled from the pool in a batch. Must only be used by a single thread.
+class FMQPoolMagazine
+{
+  using FreeObject = FMQUnsynchronizedPoolMemoryResource::FreeObject;
+
+public:
+  FMQPoolMagazine() = delete;
+  FMQPoolMagazine(const FMQPoolMagazine&) = delete;
+  FMQPoolMagazine& operator=(const FMQPoolMagazine&) = delete;
+
+  FMQPoolMagazine(std::shared_ptr<FMQUnsynchronizedPoolMemoryResource> pPool, const std::size_t pCapacity = 256)
+  : mPool(std::move(pPool)),
+    mCapacity(std::max(std::size_t(1), pCapacity))
+  { }
+
+  ~FMQPoolMagazine() {
+    flush();
+  }
+
+  std::unique_ptr<FairMQMessage> NewFairMQMessage(const std::size_t pSize = 0) {
+    (void) pSize;
+    assert(pSize <= mPool->objectSize());
+    return NewFairMQMessageWaitFor(cAllocWaitForever);
+  }
+
+  // Non-blocking allocation: returns nullptr if the magazine and the pool are empty
+  std::unique_ptr<FairMQMessage> TryNewFairMQMessage() {
+    return NewFairMQMessageWaitFor(std::chrono::microseconds(0));
+  }
+
+  std::unique_ptr<FairMQMessage> NewFairMQMessageWaitFor(const std::chrono::microseconds &pTimeout) {
+    if (!mObjects && !refill(pTimeout)) {
+      return nullptr;
+    }
+
+    FreeObject *lObj = mObjects;
+    mObjects = lObj->mNext;
+    mCount--;
+
+    std::memset(static_cast<void*>(lObj), 0, mPool->objectSize());
+    return mPool->NewFairMQMessageFromPtr(lObj);
+  }
+
+  // Return all cached objects to the pool
+  void flush() {
+    if (!mObjects) {
+      return;
+    }
+
+    FreeObject *lLast = mObjects;
+    while (lLast->mNext) {
+      lLast = lLast->mNext;
+    }
+
+    mPool->reclaimSHMMessages(mObjects, lLast, mCount);
+    mObjects = nullptr;
+    mCount = 0;
+  }
+
+  FMQUnsynchronizedPoolMemoryResource& pool() { return *mPool; }
+  std::size_t objectSize() const { return mPool->objectSize(); }
+
+private:
+  bool refill(const std::chrono::microseconds &pTimeout) {
+    assert(mObjects == nullptr);
+    mObjects = mPool->take_objects(mCapacity, mCount, pTimeout);
+    return (mObjects != nullptr);
+  }
+
+  std::shared_ptr<FMQUnsynchronizedPoolMemoryResource> mPool;
+  std::size_t mCapacity;
+
+  FreeObject *mObjects = nullptr;
+  std::size_t mCount = 0;
 };
 
 
@@ -263,49 +960,42 @@ class RegionAllocatorResource
 {
 
 public:
+  /// Selection of the free extent when the working extent is exhausted
+  enum ReclaimMode {
+    eReclaimLargest,  // take the largest free extent (keeps the bump allocation going for longer)
+    eReclaimBestFit   // take the smallest free extent that fits (keeps large extents for large requests)
+  };
+
   RegionAllocatorResource() = delete;
 
   RegionAllocatorResource(std::string pSegmentName, FairMQChannel &pChan,
-                          std::size_t pSize, std::uint64_t pRegionFlags = 0)
+                          std::size_t pSize, std::uint64_t pRegionFlags = 0,
+                          ReclaimMode pReclaimMode = eReclaimLargest,
+                          const int pNumaNode = NumaUtils::cNoNode,
+                          const bool pSlabs = true)
   : mSegmentName(pSegmentName),
-    mChan(pChan)
+    mChan(pChan),
+    mReclaimMode(pReclaimMode)
   {
     static_assert(ALIGN && !(ALIGN & (ALIGN - 1)), "Alignment must be power of 2");
 
     pSize = align_size_up(pSize);
 
-    int lMapFlags = 0;
-    std::string lSegmentRoot = "";
-
-    // don't reserve swap space and try to lock the region
-#if defined(MAP_NORESERVE) && defined(MAP_LOCKED)
-    lMapFlags = MAP_NORESERVE | MAP_LOCKED;
-#endif
+    // select the mapping: default SHM, hugetlbfs, or transparent huge pages
+    const auto lHugePageMode = getRegionHugePageMode();
+    std::size_t lPageSize = 0;
+    const std::string lSegmentRoot = getRegionSegmentRoot(lHugePageMode, lPageSize);
+    pSize = (pSize + lPageSize - 1) / lPageSize * lPageSize;
 
-    // try to use different file mapping (hugetlbfs)
-    const auto lHugetlbfsPath = std::getenv(ENV_SHM_PATH);
-    if (lHugetlbfsPath) {
-      do {
-        // make sure directory exists
-        namespace bfs = boost::filesystem;
-        bfs::path lDirPath(lHugetlbfsPath);
-        if (!bfs::is_directory(lDirPath)) {
-          DDLOGF(fair::Severity::ERROR, "Hugetlbfs mountpoint does not exist. Not using huge pages. {}={}",
-            ENV_SHM_PATH, lHugetlbfsPath);
-          break;
-        }
+    const bool lThp = (lHugePageMode == eHugePagesTransparent) && lSegmentRoot.empty();
 
-        // check if the hugetlbs is writeable
-        if (0 != access(lHugetlbfsPath, W_OK)) {
-          DDLOGF(fair::Severity::ERROR, "Hugetlbfs mountpoint is not writeable. "
-            "Make sure the permissions are properly set. {}={}", ENV_SHM_PATH, lHugetlbfsPath);
-          break;
-        }
+    int lMapFlags = 0;
 
-        lSegmentRoot = lHugetlbfsPath;
-        lSegmentRoot += bfs::path::preferred_separator;
-      } while (false);
-    }
+    // don't reserve swap space. NOTE: MAP_LOCKED is not used: it faults in all pages on this thread at mmap
+    // time. The region is locked after it is pre-faulted (see lockRegionMemory()).
+#if defined(MAP_NORESERVE)
+    lMapFlags = MAP_NORESERVE;
+#endif
 
     DDLOGF(fair::Severity::INFO, "Creating new UnmanagedRegion name={} path={} size={} channel={}",
       mSegmentName, lSegmentRoot, pSize, pChan.GetName());
@@ -320,8 +1010,23 @@ public:
           return;
         }
 
+        std::size_t lReclaimed = 0;
         for (const auto &lBlk : pBlkVect) {
-          reclaimSHMMessage(lBlk.ptr, lBlk.size);
+          const auto lSlabClass = slab_class_of(lBlk.ptr);
+          if (lSlabClass < cSlabClassCnt) {
+            slab_reclaim(lSlabClass, lBlk.ptr);
+            lReclaimed += slab_object_size(lSlabClass);
+          } else {
+            reclaimSHMMessage(lBlk.ptr, lBlk.size);
+            lReclaimed += align_size_up(lBlk.size);
+          }
+        }
+        mUsedBytes.fetch_sub(lReclaimed, std::memory_order_relaxed);
+        mExhausted.store(false, std::memory_order_relaxed);
+
+        // wake up the allocating thread if it is waiting for free memory
+        if (mAllocWaiting) {
+          mReclaimCond.notify_one();
         }
       },
       lSegmentRoot.c_str(),
@@ -336,13 +1041,73 @@ public:
 
     mStart = static_cast<char*>(mRegion->GetData());
     mLength = mRegion->GetSize();
+    mWorkingLength = mLength;
+
+    // small objects are allocated from slabs if the region is large enough
+    if (pSlabs && mLength >= cSlabMinRegionSize) {
+      mSlabsEnabled = true;
+      mSlabLimit = mLength / 4;
+      const auto lChunkCnt = (mLength + cSlabChunkSize - 1) / cSlabChunkSize;
+      mSlabChunkClass = std::make_unique<std::atomic_uint8_t[]>(lChunkCnt);
+      for (std::size_t i = 0; i < lChunkCnt; i++) {
+        mSlabChunkClass[i].store(cNoSlabClass, std::memory_order_relaxed);
+      }
+    }
+
+    // NUMA placement and huge page advice. The region is mapped without MAP_LOCKED and not touched yet,
+    // so the pages are placed on the node when they are first faulted in (no migration is needed).
+    if (pNumaNode != NumaUtils::cNoNode) {
+      NumaUtils::bindMemory(mStart, mLength, pNumaNode);
+    }
+    if (lThp) {
+      adviseTransparentHugePages(mStart, mLength);
+    }
+
+    // allocations of at least one huge page are aligned to the huge page boundary
+    if (lPageSize > std::size_t(sysconf(_SC_PAGESIZE))) {
+      mHugePageSize = lPageSize;
+    }
 
-    memset(mStart, 0xAA, mLength);
+    const auto lSetupStart = std::chrono::steady_clock::now();
+    const auto lPrefaultMode = getRegionPrefaultMode();
+
+    switch (lPrefaultMode) {
+      case ePrefaultNone:
+        break; // not locked: locking would fault in all pages on this thread
+      case ePrefaultParallel:
+        prefaultMemoryParallel(mStart, mLength, 0xAA);
+        lockRegionMemory(mStart, mLength);
+        break;
+      case ePrefaultBackground:
+        // NOTE: mStart and mLength are changed by the allocator, use the region extent
+        mPrefaultThread = std::thread([this, lSetupStart, lStart = mStart, lLength = mLength]() {
+          prefaultMemoryInPlace(lStart, lLength, mRunning);
+          if (mRunning) {
+            lockRegionMemory(lStart, lLength);
+          }
+          DDLOGF(fair::Severity::INFO, "UnmanagedRegion background pre-fault done. name={} size={} prefault_ms={:.2f}",
+            mSegmentName, lLength,
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lSetupStart).count());
+        });
+        break;
+    }
+
+    std::size_t lPmdMapped = 0;
+    mPageSize = getMappingPageSize(mStart, lPmdMapped);
+
+    DDLOGF(fair::Severity::INFO, "UnmanagedRegion setup done. name={} size={} prefault={} page_size={} "
+      "thp_mapped={} setup_ms={:.2f}", mSegmentName, mLength, getRegionPrefaultModeName(lPrefaultMode),
+      mPageSize, lPmdMapped,
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lSetupStart).count());
 
     // start the allocations
     mRunning = true;
   }
 
+  ~RegionAllocatorResource() {
+    stop();
+  }
+
   inline
   std::unique_ptr<FairMQMessage> NewFairMQMessage(std::size_t pSize) {
     auto* lMem = do_allocate(pSize, ALIGN);
@@ -353,7 +1118,65 @@ public:
     }
   }
 
+  // Non-blocking allocation: returns nullptr if the region has no free extent of adequate size
   inline
+  std::unique_ptr<FairMQMessage> TryNewFairMQMessage(std::size_t pSize) {
+    return NewFairMQMessageWaitFor(pSize, std::chrono::microseconds(0));
+  }
+
+  // Wait at most pTimeout for free memory: returns nullptr on timeout or if the region is stopped
+  inline
+  std::unique_ptr<FairMQMessage> NewFairMQMessageWaitFor(std::size_t pSize, const std::chrono::microseconds &pTimeout) {
+    auto* lMem = do_allocate(pSize, ALIGN, pTimeout);
+    if (lMem) {
+      return mChan.NewMessage(mRegion, lMem, pSize);
+    } else {
+      return nullptr;
+    }
+  }
+
+  /// Page size backing the region, as reported by the kernel
+  std::size_t pageSize() const { return mPageSize; }
+
+  RegionStats stats() const {
+    RegionStats lStats;
+    lStats.mName = mSegmentName;
+    lStats.mSize = mRegion->GetSize();
+    lStats.mUsed = mUsedBytes.load(std::memory_order_relaxed);
+    lStats.mHighWater = mHighWater.load(std::memory_order_relaxed);
+    lStats.mSlabSize = mSlabBytes.load(std::memory_order_relaxed);
+    lStats.mFallbackCnt = mFallbackCnt;
+    lStats.mStallCnt = mStallCnt;
+    lStats.mStallHist = mStallHist.Snapshot();
+
+    // the working extent of the allocator is counted as a free extent
+    std::size_t lWorkingLength = 0;
+    {
+      std::scoped_lock lLock(mReclaimLock);
+      lWorkingLength = mWorkingLength.load(std::memory_order_relaxed);
+      lStats.mFreeExtents = mFreesBySize.size() + (lWorkingLength > 0 ? 1 : 0);
+      lStats.mLargestFree = mFreesBySize.empty() ? 0 : mFreesBySize.rbegin()->first;
+    }
+    lStats.mLargestFree = std::max(lStats.mLargestFree, lWorkingLength);
+    return lStats;
+  }
+
+  // Allocate from the global SHM segment when the region is exhausted. Fallback allocations are counted.
+  inline
+  std::unique_ptr<FairMQMessage> NewFallbackMessage(const std::size_t pSize) {
+    if (mFallbackCnt++ % 1024 == 0) {
+      DDLOGF(fair::Severity::WARNING, "Memory region exhausted. Allocating from the global SHM pool. "
+        "segment={} size={} fallback_allocations={}", mSegmentName, pSize, mFallbackCnt.load());
+    }
+
+    return mChan.NewMessage(pSize);
+  }
+
+  std::uint64_t fallbackCount() const { return mFallbackCnt; }
+
+  // A timed allocation found no free extent, and no memory was returned since. Callers should not wait again.
+  bool exhausted() const { return mExhausted.load(std::memory_order_relaxed); }
+
   std::unique_ptr<FairMQMessage> NewFairMQMessageFromPtr(void *pPtr, const std::size_t pSize) {
     assert(pPtr >= static_cast<char*>(mRegion->GetData()));
     assert(static_cast<char*>(pPtr)+pSize <= static_cast<char*>(mRegion->GetData()) + mRegion->GetSize());
@@ -369,8 +1192,15 @@ public:
   }
 
   inline void stop() {
-    std::scoped_lock lock(mReclaimLock);
-    mRunning = false;
+    {
+      std::scoped_lock lock(mReclaimLock);
+      mRunning = false;
+      mReclaimCond.notify_all();
+    }
+
+    if (mPrefaultThread.joinable()) {
+      mPrefaultThread.join();
+    }
   }
 
 protected:
@@ -381,14 +1211,16 @@ protected:
     return (pSize + ALIGN - 1) / ALIGN * ALIGN;
   }
 
-  void* do_allocate(std::size_t pSize, std::size_t /* pAlign */)
+  void* do_allocate(std::size_t pSize, std::size_t /* pAlign */,
+                    const std::chrono::microseconds &pTimeout = cAllocWaitForever)
   {
+    using namespace std::chrono_literals;
+    using clock = std::chrono::steady_clock;
+
     if (!mRunning) {
       return nullptr;
     }
 
-    unsigned long lAllocAttempt = 0;
-
     if (pSize == 0) {
        DDLOGF(fair::Severity::WARNING, "Zero message allocation name={}: {}",
         mSegmentName, __LINE__);
@@ -397,28 +1229,79 @@ protected:
     // align up
     pSize = align_size_up(pSize);
 
-    auto lRet = try_alloc(pSize);
-    // we cannot fail! report problem if failing to allocate block often
-    while (!lRet && mRunning) {
-      // try to reclaim if possible
-      if (try_reclaim(pSize)) {
-        // try again
+    // small objects are allocated from their slab class, or from the extents if the class cannot grow
+    const auto lSlabClass = slab_class(pSize);
+    const bool lSlabAlloc = (lSlabClass < cSlabClassCnt);
+    std::size_t lAllocSize = pSize;
+
+    auto lRet = lSlabAlloc ? slab_alloc(lSlabClass, lAllocSize) : nullptr;
+    if (!lRet) {
+      lRet = try_alloc(pSize);
+    }
+    if (lRet) {
+      updateHighWater(mHighWater, mUsedBytes.fetch_add(lAllocSize, std::memory_order_relaxed) + lAllocSize);
+      return lRet;
+    }
+
+    const auto lWaitStart = clock::now();
+    auto lLastWarning = lWaitStart;
+
+    std::unique_lock<std::mutex> lLock(mReclaimLock);
+    mAllocWaiting = true;
+    bool lStalled = false;
+
+    // wait for the region callback to return memory, or the timeout
+    while (mRunning) {
+      if (lSlabAlloc) {
+        lRet = slab_alloc(lSlabClass, lAllocSize);
+        // make room for a new slab chunk (aligned to the chunk size)
+        if (!lRet && slab_can_grow(lSlabClass) && try_reclaim(2 * cSlabChunkSize)) {
+          lRet = slab_alloc(lSlabClass, lAllocSize);
+        }
+      }
+      if (!lRet && try_reclaim(pSize)) {
         lRet = try_alloc(pSize);
       }
 
-      if (!lRet) {
-        using namespace std::chrono_literals;
-        std::this_thread::sleep_for(1ms);
+      if (lRet) {
+        break;
+      }
 
-        if (++lAllocAttempt % 512 == 0) {
-          DDLOGF(fair::Severity::WARNING,
-            "RegionAllocatorResource: failing to allocate free block of {} B, total region size: {} B",
-            pSize, mRegion->GetSize());
-          DDLOGF(fair::Severity::WARNING, "Memory segment '{}' too small or large back-pressure.", mSegmentName);
-        }
+      const auto lNow = clock::now();
+      const auto lWaited = std::chrono::duration_cast<std::chrono::microseconds>(lNow - lWaitStart);
+      if (pTimeout >= 0us && lWaited >= pTimeout) {
+        mExhausted.store(true, std::memory_order_relaxed);
+        break;
+      }
+
+      if (lNow - lLastWarning >= 1s) {
+        lLastWarning = lNow;
+        DDLOGF(fair::Severity::WARNING,
+          "RegionAllocatorResource: waiting for free block of {} B, total region size: {} B, waited: {} ms",
+          pSize, mRegion->GetSize(), std::chrono::duration_cast<std::chrono::milliseconds>(lWaited).count());
+        DDLOGF(fair::Severity::WARNING, "Memory segment '{}' too small or large back-pressure.", mSegmentName);
+      }
+
+      auto lWaitFor = std::chrono::duration_cast<std::chrono::microseconds>(cAllocWaitSlice);
+      if (pTimeout >= 0us) {
+        lWaitFor = std::min(lWaitFor, pTimeout - lWaited);
       }
+
+      lStalled = true;
+      mReclaimCond.wait_for(lLock, lWaitFor);
+    }
+
+    mAllocWaiting = false;
+
+    // only count allocations that had to wait for the transport to return memory
+    if (lStalled) {
+      mStallCnt++;
+      mStallHist.Fill(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - lWaitStart).count());
     }
 
+    if (lRet) {
+      updateHighWater(mHighWater, mUsedBytes.fetch_add(lAllocSize, std::memory_order_relaxed) + lAllocSize);
+    }
     return lRet;
   }
 
@@ -435,7 +1318,113 @@ protected:
   }
 
 private:
+  /// Slab class of the (aligned) size, or cSlabClassCnt if not allocated from slabs
+  std::size_t slab_class(const std::size_t pSize) const {
+    if (!mSlabsEnabled || pSize > cSlabMaxObjectSize) {
+      return cSlabClassCnt;
+    }
+
+    std::size_t lClass = 0;
+    while ((cSlabMinObjectSize << lClass) < pSize) {
+      lClass++;
+    }
+    return lClass;
+  }
+
+  static constexpr
+  std::size_t slab_object_size(const std::size_t pClass) {
+    return cSlabMinObjectSize << pClass;
+  }
+
+  /// Slab class of the chunk holding the object, or cSlabClassCnt if allocated from the extents
+  std::size_t slab_class_of(const void *pData) const {
+    if (!mSlabsEnabled) {
+      return cSlabClassCnt;
+    }
+
+    const auto lOff = static_cast<const char*>(pData) - static_cast<const char*>(mRegion->GetData());
+    const auto lClass = mSlabChunkClass[lOff / cSlabChunkSize].load(std::memory_order_acquire);
+    return (lClass == cNoSlabClass) ? cSlabClassCnt : lClass;
+  }
+
+  // NOTE: every class can take at least one chunk, so small allocations cannot starve
+  bool slab_can_grow(const std::size_t pClass) const {
+    return (mSlabClasses[pClass].mChunkCnt == 0) ||
+      (mSlabBytes.load(std::memory_order_relaxed) + cSlabChunkSize <= mSlabLimit);
+  }
+
+  // allocator thread only
+  void* slab_alloc(const std::size_t pClass, std::size_t &pAllocSize) {
+    auto &lClass = mSlabClasses[pClass];
+
+    if (!lClass.mFree) {
+      // take all reclaimed objects at once
+      lClass.mFree = lClass.mReclaimed.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    if (!lClass.mFree && slab_can_grow(pClass)) {
+      // carve a new chunk from the working extent. Chunks start at a multiple of the chunk size from the
+      // region start, so the region callback can find the class from the object address.
+      const auto lRegionOff = mStart ? (mStart - static_cast<char*>(mRegion->GetData())) % cSlabChunkSize : 0;
+      const std::size_t lGap = lRegionOff ? (cSlabChunkSize - lRegionOff) : 0;
+      char *lChunk = nullptr;
+      if (mLength >= lGap + cSlabChunkSize) {
+        if (lGap > 0) {
+          mAlignGaps.emplace_back(mStart, lGap);
+          mStart += lGap;
+          mLength -= lGap;
+        }
+        lChunk = static_cast<char*>(try_alloc(cSlabChunkSize));
+      }
+      if (lChunk) {
+        const auto lChunkIdx = (lChunk - static_cast<char*>(mRegion->GetData())) / cSlabChunkSize;
+        mSlabChunkClass[lChunkIdx].store(static_cast<std::uint8_t>(pClass), std::memory_order_release);
+
+        const auto lObjSize = slab_object_size(pClass);
+        for (std::size_t lOff = cSlabChunkSize; lOff > 0; lOff -= lObjSize) {
+          auto *lObj = reinterpret_cast<SlabObject*>(lChunk + lOff - lObjSize);
+          lObj->mNext = lClass.mFree;
+          lClass.mFree = lObj;
+        }
+        lClass.mChunkCnt++;
+        mSlabBytes.fetch_add(cSlabChunkSize, std::memory_order_relaxed);
+      }
+    }
+
+    if (!lClass.mFree) {
+      return nullptr;
+    }
+
+    auto *lObj = lClass.mFree;
+    lClass.mFree = lObj->mNext;
+    pAllocSize = slab_object_size(pClass);
+    return lObj;
+  }
+
+  // region callback: push the object on the reclaim stack of the class (MPSC)
+  void slab_reclaim(const std::size_t pClass, void *pData) {
+    auto &lClass = mSlabClasses[pClass];
+    auto *lObj = static_cast<SlabObject*>(pData);
+
+    SlabObject *lHead = lClass.mReclaimed.load(std::memory_order_relaxed);
+    do {
+      lObj->mNext = lHead;
+    } while (!lClass.mReclaimed.compare_exchange_weak(lHead, lObj,
+      std::memory_order_release, std::memory_order_relaxed));
+  }
+
   void* try_alloc(const std::size_t pSize) {
+    // start large allocations on a huge page boundary. The skipped extent is freed on the next reclaim.
+    if (mHugePageSize && pSize >= mHugePageSize && mLength > 0) {
+      const auto lAddr = reinterpret_cast<std::uintptr_t>(mStart);
+      const std::size_t lGap = (mHugePageSize - (lAddr % mHugePageSize)) % mHugePageSize;
+      if (lGap > 0 && mLength >= lGap + pSize) {
+        mAlignGaps.emplace_back(mStart, lGap);
+        mStart += lGap;
+        mLength -= lGap;
+      }
+    }
+
     if (mLength >= pSize) {
       const auto lObjectPtr = mStart;
 
@@ -445,6 +1434,7 @@ private:
       if (mLength == 0) {
         mStart = nullptr;
       }
+      mWorkingLength.store(mLength, std::memory_order_relaxed);
 
       return lObjectPtr;
     }
@@ -453,10 +1443,15 @@ private:
   }
 
 
+  // NOTE: caller must hold mReclaimLock lock
   bool try_reclaim(const std::size_t pSize) {
-    // First declare any leftover memory as free
-    std::scoped_lock lock(mReclaimLock);
+    // return extents skipped for huge page alignment
+    for (const auto &lGap : mAlignGaps) {
+      reclaimSHMMessage(lGap.first, lGap.second);
+    }
+    mAlignGaps.clear();
 
+    // First declare any leftover memory as free
     if (mLength > 0) {
       assert(mStart != nullptr);
       // NOTE: caller must hold mReclaimLock lock
@@ -464,25 +1459,32 @@ private:
       // invalidate the working extent
       mLength = 0;
       mStart = nullptr;
+      mWorkingLength.store(0, std::memory_order_relaxed);
     }
 
-    if (mFrees.empty()) {
+    if (mFreesBySize.empty()) {
       return false;
     }
 
-    // find the largest free extent and return it if the size is adequate
-    auto lMaxIter = std::max_element(std::begin(mFrees), std::end(mFrees),
-      [](const auto& l, const auto& r) { return l.second < r.second; });
+    // find the extent in the size index: O(log n) in the number of free extents
+    auto lSizeIter = mFreesBySize.end();
+    if (mReclaimMode == eReclaimBestFit) {
+      lSizeIter = mFreesBySize.lower_bound(std::make_pair(pSize, static_cast<const char*>(nullptr)));
+    } else {
+      lSizeIter = std::prev(mFreesBySize.end());
+    }
 
     // check if the size is adequate
-    if (pSize > lMaxIter->second) {
+    if (lSizeIter == mFreesBySize.end() || pSize > lSizeIter->first) {
       return false;
     }
 
     // return the extent
-    mStart = const_cast<char*>(lMaxIter->first);
-    mLength = lMaxIter->second;
-    mFrees.erase(lMaxIter);
+    mStart = const_cast<char*>(lSizeIter->second);
+    mLength = lSizeIter->first;
+    mFrees.erase(lSizeIter->second);
+    mFreesBySize.erase(lSizeIter);
+    mWorkingLength.store(mLength, std::memory_order_relaxed);
 
     return true;
   }
@@ -516,16 +1518,20 @@ private:
       auto lPrev = std::prev(lIter);
 
       if ((lPrev->first + lPrev->second) == lData) {
+        mFreesBySize.erase(std::make_pair(lPrev->second, lPrev->first));
         lPrev->second += pSize;
         lInserted = true;
 
         // check if we also can merge with the next (lIter)
         if (lIter != mFrees.end()) {
           if ((lPrev->first + lPrev->second) == lIter->first) {
+            mFreesBySize.erase(std::make_pair(lIter->second, lIter->first));
             lPrev->second += lIter->second;
             mFrees.erase(lIter);
           }
         }
+
+        mFreesBySize.emplace(lPrev->second, lPrev->first);
       }
     }
 
@@ -536,16 +1542,20 @@ private:
       if (lIt->second != pSize) {
         DDLOGF(fair::Severity::ERROR, "BUG: RegionAllocatorResource: REPEATED INSERT!!! "
           " {:p} : {}, original size: {}", lIt->first, pSize, lIt->second);
+        mFreesBySize.erase(std::make_pair(lIt->second, lIt->first));
       }
 
       // check if we can merge with the next
       auto lNextIt = std::next(lIt);
       if (lNextIt != mFrees.cend()) {
         if ((lData + pSize) == lNextIt->first) {
+          mFreesBySize.erase(std::make_pair(lNextIt->second, lNextIt->first));
           lIt->second += lNextIt->second;
           mFrees.erase(lNextIt);
         }
       }
+
+      mFreesBySize.emplace(lIt->second, lIt->first);
     }
   }
 
@@ -559,9 +1569,56 @@ private:
   char *mStart = nullptr;
   std::size_t mLength = 0;
 
+  std::thread mPrefaultThread;
+
+  std::size_t mPageSize = 0;
+  std::size_t mHugePageSize = 0; // alignment of large allocations, 0 if not using huge pages
+  std::vector<std::pair<char*, std::size_t>> mAlignGaps; // allocator thread only
+
+  // slabs: small objects are allocated from fixed size chunks, kept in per-class free stacks.
+  // Chunks are carved from the extents and are never returned. When a class cannot grow, its objects
+  // are allocated from the extents.
+  static constexpr std::size_t cSlabMinObjectSize = std::max(ALIGN, std::size_t(64));
+  static constexpr std::size_t cSlabClassCnt = 6;
+  static constexpr std::size_t cSlabMaxObjectSize = cSlabMinObjectSize << (cSlabClassCnt - 1);
+  static constexpr std::size_t cSlabChunkSize = std::max(std::size_t(256) << 10, cSlabMaxObjectSize * 64);
+  static constexpr std::size_t cSlabMinRegionSize = cSlabChunkSize * 64;
+  static constexpr std::uint8_t cNoSlabClass = 0xFF;
+
+  struct SlabObject {
+    SlabObject *mNext;
+  };
+
+  struct SlabClass {
+    SlabObject *mFree = nullptr; // allocator thread only
+    std::atomic<SlabObject*> mReclaimed = nullptr; // pushed by the region callback
+    std::size_t mChunkCnt = 0; // allocator thread only
+  };
+
+  bool mSlabsEnabled = false;
+  std::size_t mSlabLimit = 0; // max bytes used by slab chunks
+  std::unique_ptr<std::atomic_uint8_t[]> mSlabChunkClass; // slab class of each chunk sized block of the region
+  std::atomic_size_t mSlabBytes = 0;
+  std::array<SlabClass, cSlabClassCnt> mSlabClasses;
+
+  // telemetry
+  std::atomic_size_t mUsedBytes = 0;
+  std::atomic_size_t mHighWater = 0;
+  std::atomic_size_t mWorkingLength = 0; // published copy of mLength
+  std::atomic_uint64_t mStallCnt = 0;
+  AllocStallHistogram mStallHist;
+
   // two step reclaim to avoid lock contention in the allocation path
-  std::mutex mReclaimLock;
-  std::map<const char*, std::size_t> mFrees; // keep all returned blocks
+  mutable std::mutex mReclaimLock;
+  std::condition_variable mReclaimCond;
+  bool mAllocWaiting = false; // guarded by mReclaimLock
+  ReclaimMode mReclaimMode;
+  std::map<const char*, std::size_t> mFrees; // keep all returned blocks (address ordered, for merging)
+  std::set<std::pair<std::size_t, const char*>> mFreesBySize; // same extents, indexed by size
+
+  // allocations served from the global SHM segment
+  std::atomic_uint64_t mFallbackCnt = 0;
+  std::atomic_bool mExhausted = false; // set on an allocation timeout, cleared by the region callback
 };
 
 }
@@ -26,6 +26,8 @@
 #include <cstdint>
 #include <tuple>
 #include <variant>
+#include <string>
+#include <type_traits>
 
 namespace o2
 {
@@ -179,6 +181,82 @@ using RDHv4Reader = RDHReaderImpl<o2::header::RAWDataHeaderV4>; // V4 and V3 are
 using RDHv5Reader = RDHReaderImpl<o2::header::RAWDataHeaderV5>;
 using RDHv6Reader = RDHReaderImpl<o2::header::RAWDataHeaderV6>;
 
+////////////////////////////////////////////////////////////////////////////////
+/// RDH reader for a version known at compile time
+/// Same interface as RDHReader. Calls into the final RDHReaderImpl are resolved statically,
+/// so the field access is inlined. Use ReadoutDataUtils::dispatchRdhVersion() to select it.
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename RDH>
+class RDHReaderT {
+  inline static const RDHReaderImpl<RDH> sImpl = RDHReaderImpl<RDH>();
+
+  const char *mData = nullptr;
+  std::size_t mSize = 0;
+
+public:
+  using rdh_type = RDH;
+
+  RDHReaderT() = default;
+
+  RDHReaderT(const char* data, const std::size_t size)
+  : mData(data),
+    mSize(size)
+  {
+    sImpl.CheckRdhData(mData, mSize);
+  }
+
+  explicit RDHReaderT(const FairMQMessagePtr &msg)
+  : RDHReaderT(reinterpret_cast<const char*>(msg->GetData()), msg->GetSize()) { }
+
+  RDHReaderT next() const {
+    if (getStopBit()) {
+      return RDHReaderT();
+    }
+
+    const char *p = mData + getOffsetToNext();
+
+    if (((mData + mSize) - sizeof(RDH)) < p) {
+      return RDHReaderT(); // the rest of original buffer is too short
+    }
+
+    RDHReaderT lNext;
+    lNext.mData = p;
+    lNext.mSize = mData + mSize - p;
+    return lNext;
+  }
+
+  RDHReaderT end() const { return RDHReaderT(); }
+
+  bool operator==(const RDHReaderT& b) const { return (mData == b.mData && mSize == b.mSize); }
+  bool operator!=(const RDHReaderT &b) const { return !(*this == b); }
+
+  static constexpr std::size_t getRDHSize() { return sizeof(RDH); }
+
+  // RDH equipment
+  std::uint8_t getSystemID() const { return sImpl.getSystemID(mData); }
+  std::uint64_t getFeeID() const { return sImpl.getFeeID(mData); }
+  std::uint16_t getLinkID() const { return sImpl.getLinkID(mData); }
+  std::uint8_t getEndPointID() const { return sImpl.getEndPointID(mData); }
+  std::uint16_t getCruID() const { return sImpl.getCruID(mData); }
+
+  // RDH memory layout
+  std::uint32_t getMemorySize() const { return sImpl.getMemorySize(mData); }
+  std::uint32_t getOffsetToNext() const { return sImpl.getOffsetToNext(mData); }
+  bool getStopBit() const { return sImpl.getStopBit(mData); }
+
+  // RDH trigger information
+  std::uint32_t getOrbit() const { return sImpl.getOrbit(mData); }
+  std::uint16_t getBC() const { return sImpl.getBC(mData); }
+  std::uint32_t getTriggerType() const { return sImpl.getTriggerType(mData); }
+};
+
+/// Tag type carrying the RDH type selected by ReadoutDataUtils::dispatchRdhVersion()
+template <typename RDH>
+struct RDHVersionTag {
+  using type = RDH;
+};
+
 class RDHReader {
   // NOTE: This must be set in the Init() phase. Logical program error otherwise.
   static std::unique_ptr<RDHReaderIf> sRDHReader;
@@ -335,6 +413,47 @@ struct ReadoutSubTimeframeHeader {
   std::uint8_t mLinkId;       // common link id of all data in this HBFrame
 };
 
+////////////////////////////////////////////////////////////////////////////////
+/// RDHFrameSummary
+/// Result of a single walk over the RDH pages of one HBFrame (readout data block).
+/// Shared by the sanity check, the empty trigger filter and the sidecar writer.
+////////////////////////////////////////////////////////////////////////////////
+
+struct RDHFrameSummary {
+  enum Status {
+    eOk = 0,
+    eShortData,         // remaining data is shorter than the RDH
+    eSubSpecMismatch,   // sub-specification differs from the first page
+    eStopMemorySize,    // stop bit set, but memory size exceeds the remaining data
+    eZeroOffset,        // offsetToNext is 0
+    eOffsetBeyondEnd,   // offsetToNext points beyond the end, and no stop bit
+    eMemorySizeBeyondEnd
+  };
+
+  Status mStatus = eOk;
+  std::uint32_t mRdhSize = 0;
+  std::uint32_t mNumPages = 0;      // pages walked, including the one with an error
+  std::uint32_t mNumEmptyPages = 0; // pages with memory size equal to the RDH size
+  std::size_t mMemorySize = 0;      // sum of memory sizes of the walked pages
+  bool mStopBit = false;            // stop bit of the last walked page
+  std::size_t mSize = 0;            // bytes of the HBFrame, up to the end of the page with the stop bit (if ok)
+
+  // first page
+  o2::header::DataHeader::SubSpecificationType mSubSpec = ~o2::header::DataHeader::SubSpecificationType(0);
+  std::uint64_t mFeeId = 0;
+  std::uint16_t mLinkId = 0;
+  std::uint32_t mOrbit = 0;
+  std::uint16_t mBC = 0;
+  std::uint32_t mTriggerType = 0;
+
+  // page with an error
+  std::size_t mErrorOffset = 0;
+  std::uint32_t mErrorMemorySize = 0;
+  o2::header::DataHeader::SubSpecificationType mErrorSubSpec = ~o2::header::DataHeader::SubSpecificationType(0);
+
+  bool ok() const { return mStatus == eOk; }
+};
+
 class ReadoutDataUtils {
 public:
   enum SubSpecMode {
@@ -368,9 +487,75 @@ public:
   static o2::header::DataOrigin getDataOrigin(const RDHReader &R);
   static o2::header::DataHeader::SubSpecificationType getSubSpecification(const RDHReader &R);
 
+  template <typename RDH>
+  static o2::header::DataOrigin getDataOrigin(const RDHReaderT<RDH> &R)
+  {
+    if constexpr (std::is_same_v<RDH, o2::header::RAWDataHeaderV6>) {
+      return o2::header::DAQID::DAQtoO2(R.getSystemID());
+    } else {
+      (void) R;
+      return sSpecifiedDataOrigin;
+    }
+  }
+
+  template <typename RDH>
+  static o2::header::DataHeader::SubSpecificationType getSubSpecification(const RDHReaderT<RDH> &R)
+  {
+    if (sRawDataSubspectype == eFeeId) {
+      return R.getFeeID();
+    }
+    /* add 1 to linkID because they start with 0 */
+    return (R.getCruID() << 16) | ((R.getLinkID() + 1) << (R.getEndPointID() == 0 ? 0 : 8));
+  }
+
+  /// RDH version of the data: the configured one, or the one of the first RDH if not configured
+  static RdhVersion rdhVersion(const char* pData, const std::size_t pSize)
+  {
+    if (sRdhVersion != eRdhInvalid || !pData || pSize == 0) {
+      return sRdhVersion;
+    }
+    return (pData[0] >= eRdhVer3 && pData[0] <= eRdhVer6) ? RdhVersion(pData[0]) : eRdhInvalid;
+  }
+
+  /// Call pFunc with the RDH type of the version, as RDHVersionTag<RDH>. Used to select the
+  /// version specific processing once per readout update instead of per RDH field access.
+  template <typename F>
+  static decltype(auto) dispatchRdhVersion(const RdhVersion pVer, F&& pFunc)
+  {
+    switch (pVer) {
+      case eRdhVer3:
+      case eRdhVer4:
+        return pFunc(RDHVersionTag<o2::header::RAWDataHeaderV4>());
+      case eRdhVer5:
+        return pFunc(RDHVersionTag<o2::header::RAWDataHeaderV5>());
+      case eRdhVer6:
+        return pFunc(RDHVersionTag<o2::header::RAWDataHeaderV6>());
+      default:
+        throw RDHReaderException(nullptr, 0, "Unknown RDH version " + std::to_string(int(pVer)));
+    }
+  }
+
   static std::tuple<std::size_t, bool> getHBFrameMemorySize(const FairMQMessagePtr &pMsg);
 
+  /// Walk all RDH pages of the HBFrame once. Throws RDHReaderException on unknown RDH version.
+  static RDHFrameSummary scanHBFrame(const char* pData, const std::size_t pLen);
+  template <typename RDH>
+  static RDHFrameSummary scanHBFrame(const char* pData, const std::size_t pLen);
+
+  static bool rdhSanityCheck(const char* data, const std::size_t len);
+  static bool filterEmptyTriggerBlocks(const char* pData, const std::size_t pLen);
+
+  // checks on an existing summary of the block (see scanHBFrame())
+  static bool rdhSanityCheck(const RDHFrameSummary &pSummary, const char* pData, const std::size_t pLen);
+  static bool filterEmptyTriggerBlocks(const RDHFrameSummary &pSummary, const std::size_t pLen);
+
+  // only blocks of these sizes can be empty trigger blocks
+  static bool isEmptyTriggerBlockSize(const std::size_t pLen) { return pLen == 64 || pLen == 128 || pLen == 16384; }
+
+  // version specific implementations (RDH: RAWDataHeaderV4, V5 or V6)
+  template <typename RDH>
   static bool rdhSanityCheck(const char* data, const std::size_t len);
+  template <typename RDH>
   static bool filterEmptyTriggerBlocks(const char* pData, const std::size_t pLen);
 };
 
@@ -22,7 +22,11 @@
 #include <Framework/DataProcessingHeader.h>
 
 #include <vector>
+#include <array>
+#include <map>
+#include <unordered_map>
 #include <mutex>
+#include <chrono>
 
 class FairMQDevice;
 class FairMQChannel;
@@ -32,6 +36,108 @@ namespace o2
 namespace DataDistribution
 {
 
+/// Longest wait for a free header before allocating it from the global SHM segment
+static constexpr std::chrono::milliseconds cHeaderAllocWait = std::chrono::milliseconds(10);
+
+/// Wait for a free header only if the previous wait did not time out. An exhausted pool or region
+/// is tried without waiting until it reclaims memory.
+template <class T>
+inline std::chrono::microseconds headerAllocWait(const T &pMemRes) {
+  return pMemRes.exhausted() ? std::chrono::microseconds(0) : std::chrono::microseconds(cHeaderAllocWait);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Link statistics
+////////////////////////////////////////////////////////////////////////////////
+
+/// Occupancy and data quality counters of one link (equipment), taken from the RDH pages of its HBFrames
+struct LinkStats {
+  std::uint64_t mHbfs = 0;
+  std::uint64_t mBytes = 0;
+  std::uint64_t mPages = 0;
+  std::uint64_t mEmptyHbfs = 0;     // HBFrames without payload (all pages are empty)
+  std::uint64_t mRdhErrors = 0;     // HBFrames with an invalid RDH page layout
+  std::uint64_t mOrbitGaps = 0;     // consecutive HBFrames with non-consecutive orbits
+  std::uint64_t mMissingOrbits = 0; // orbits skipped by the gaps
+  std::uint32_t mTriggerTypes = 0;  // OR of the trigger types of all HBFrames
+
+  // orbit of the previous HBFrame, only tracked within one STF
+  std::uint32_t mLastOrbit = 0;
+  bool mLastOrbitValid = false;
+
+  void add(const RDHFrameSummary &pSummary, const std::size_t pSize)
+  {
+    mHbfs++;
+    mBytes += pSize;
+    mPages += pSummary.mNumPages;
+
+    if (!pSummary.ok()) {
+      mRdhErrors++;
+    }
+
+    if (pSummary.mNumPages == 0) {
+      return; // no valid RDH
+    }
+
+    if (pSummary.mNumEmptyPages == pSummary.mNumPages) {
+      mEmptyHbfs++;
+    }
+
+    mTriggerTypes |= pSummary.mTriggerType;
+
+    // the same orbit can be continued in the next HBFrame
+    if (mLastOrbitValid && pSummary.mOrbit != mLastOrbit && pSummary.mOrbit != mLastOrbit + 1) {
+      mOrbitGaps++;
+      if (pSummary.mOrbit > mLastOrbit) {
+        mMissingOrbits += pSummary.mOrbit - mLastOrbit - 1;
+      }
+    }
+    mLastOrbit = pSummary.mOrbit;
+    mLastOrbitValid = true;
+  }
+
+  void merge(const LinkStats &pOther)
+  {
+    mHbfs += pOther.mHbfs;
+    mBytes += pOther.mBytes;
+    mPages += pOther.mPages;
+    mEmptyHbfs += pOther.mEmptyHbfs;
+    mRdhErrors += pOther.mRdhErrors;
+    mOrbitGaps += pOther.mOrbitGaps;
+    mMissingOrbits += pOther.mMissingOrbits;
+    mTriggerTypes |= pOther.mTriggerTypes;
+  }
+};
+
+using LinkStatsMap = std::map<o2::header::DataHeader::SubSpecificationType, LinkStats>;
+
+/// Totals of all builders. Each builder counts into its own map and merges it once per STF.
+class LinkStatsCollector
+{
+ public:
+  void merge(std::unordered_map<o2::header::DataHeader::SubSpecificationType, LinkStats> &pLocal)
+  {
+    std::scoped_lock lLock(mLock);
+
+    for (auto &lLink : pLocal) {
+      if (lLink.second.mHbfs > 0) {
+        mTotals[lLink.first].merge(lLink.second);
+      }
+      lLink.second = LinkStats(); // keep the entry to avoid allocating for the next STF
+    }
+  }
+
+  LinkStatsMap snapshot() const
+  {
+    std::scoped_lock lLock(mLock);
+    return mTotals;
+  }
+
+ private:
+  mutable std::mutex mLock;
+  LinkStatsMap mTotals;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 /// SubTimeFrameReadoutBuilder
 ////////////////////////////////////////////////////////////////////////////////
@@ -40,19 +146,51 @@ class SubTimeFrameReadoutBuilder
 {
  public:
   SubTimeFrameReadoutBuilder() = delete;
-  SubTimeFrameReadoutBuilder(FairMQChannel& pChan, bool pDplEnabled);
+  SubTimeFrameReadoutBuilder(std::shared_ptr<FMQUnsynchronizedPoolMemoryResource> pHeaderPool, bool pDplEnabled);
+
+  /// Header pool shared by all builders. Each builder allocates through its own magazine.
+  /// pChunkObjects > 0: pool of chunks holding the headers of one equipment contiguously (see newHeaderMessage())
+  static std::shared_ptr<FMQUnsynchronizedPoolMemoryResource> createHeaderPool(FairMQChannel& pChan,
+    const std::size_t pHdrSegSize, bool pDplEnabled, const int pNumaNode = NumaUtils::cNoNode,
+    const std::size_t pChunkObjects = 0);
+
+  /// Size of one header object in the pool
+  static std::size_t headerObjectSize(bool pDplEnabled);
+
+  void addHbFrames(const o2::header::DataOrigin &pDataOrig,
+    const o2::header::DataHeader::SubSpecificationType pSubSpecification,
+    ReadoutSubTimeframeHeader& pHdr,
+    std::vector<FairMQMessagePtr>::iterator pHbFramesBegin, const std::size_t pHBFrameLen);
 
+  /// Version specific implementation (RDH: RAWDataHeaderV4, V5 or V6)
+  template <typename RDH>
   void addHbFrames(const o2::header::DataOrigin &pDataOrig,
     const o2::header::DataHeader::SubSpecificationType pSubSpecification,
     ReadoutSubTimeframeHeader& pHdr,
     std::vector<FairMQMessagePtr>::iterator pHbFramesBegin, const std::size_t pHBFrameLen);
+
   std::unique_ptr<SubTimeFrame> getStf();
 
+  /// Merge consecutive HBFrames of an equipment into payloads of up to pMaxPayloadSize, copied into an own region
+  void enableHbfCoalescing(FairMQChannel& pChan, const std::size_t pRegionSize, const std::size_t pMaxPayloadSize,
+    const int pNumaNode = NumaUtils::cNoNode);
+
+  /// Count per link statistics into pCollector
+  void enableLinkStats(std::shared_ptr<LinkStatsCollector> pCollector) { mLinkStatsCollector = std::move(pCollector); }
+
   inline void stop() {
     mRunning = false;
 
     if (mHeaderMemRes) {
-      mHeaderMemRes->stop();
+      mHeaderMemRes->pool().stop();
+    }
+
+    if (mHeaderChunkPool) {
+      mHeaderChunkPool->stop();
+    }
+
+    if (mCoalesceMemRes) {
+      mCoalesceMemRes->stop();
     }
   }
 
@@ -66,7 +204,34 @@ class SubTimeFrameReadoutBuilder
 
   bool mDplEnabled;
 
-  std::unique_ptr<FMQUnsynchronizedPoolMemoryResource> mHeaderMemRes;
+  // per update storage, reused to avoid allocations for each HBFrame
+  std::vector<bool> mKeepBlocks;
+  std::array<char, sizeof(o2::header::DataHeader) + sizeof(o2::framework::DataProcessingHeader)> mHdrTemplate;
+
+  std::unique_ptr<FMQPoolMagazine> mHeaderMemRes;
+
+  // chunked headers: the headers of one equipment are slices of the open chunk of the equipment
+  struct HeaderChunk {
+    void *mObj = nullptr;
+    std::size_t mUsed = 0;
+  };
+  std::shared_ptr<FMQUnsynchronizedPoolMemoryResource> mHeaderChunkPool;
+  std::size_t mHeaderChunkObjects = 0;
+  std::unordered_map<o2::header::DataHeader::SubSpecificationType, HeaderChunk> mHeaderChunks;
+
+  FairMQMessagePtr newHeaderMessage(const o2::header::DataHeader::SubSpecificationType pSubSpec);
+  void closeHeaderChunks();
+
+  // HBFrame coalescing (optional)
+  std::unique_ptr<RegionAllocatorResource<>> mCoalesceMemRes;
+  std::size_t mCoalesceMaxSize = 0;
+
+  FairMQMessagePtr coalesceHbFrames(std::vector<FairMQMessagePtr>::iterator pHbFramesBegin,
+    const std::size_t pFirst, const std::size_t pEnd, const std::size_t pPayloadSize);
+
+  // link statistics (optional): counted locally, merged into the collector when the STF is finished
+  std::shared_ptr<LinkStatsCollector> mLinkStatsCollector;
+  std::unordered_map<o2::header::DataHeader::SubSpecificationType, LinkStats> mLinkStats;
 };
 
 
@@ -78,7 +243,8 @@ class SubTimeFrameFileBuilder
 {
  public:
   SubTimeFrameFileBuilder() = delete;
-  SubTimeFrameFileBuilder(FairMQChannel& pChan, const std::size_t pDataSegSize, bool pDplEnabled);
+  SubTimeFrameFileBuilder(FairMQChannel& pChan, const std::size_t pDataSegSize, const std::size_t pHdrSegSize,
+    bool pDplEnabled, const int pNumaNode = NumaUtils::cNoNode);
 
   void adaptHeaders(SubTimeFrame *pStf);
 
@@ -96,17 +262,22 @@ class SubTimeFrameFileBuilder
         o2::framework::DataProcessingHeader{pTfId}
       );
 
-      lMsg = mHeaderMemRes->NewFairMQMessage(lStack.size());
+      lMsg = newHeaderMessage(lStack.size());
       std::memcpy(lMsg->GetData(), lStack.data(), lStack.size());
 
     } else {
-      lMsg = mHeaderMemRes->NewFairMQMessage(pIncomingStack.size());
+      lMsg = newHeaderMessage(pIncomingStack.size());
       std::memcpy(lMsg->GetData(), pIncomingStack.data(), pIncomingStack.size());
     }
 
     return lMsg;
   }
 
+  FairMQMessagePtr newHeaderMessage(const std::size_t pSize) {
+    auto lMsg = mHeaderMemRes->NewFairMQMessageWaitFor(pSize, headerAllocWait(*mHeaderMemRes));
+    return lMsg ? std::move(lMsg) : mHeaderMemRes->NewFallbackMessage(pSize);
+  }
+
   inline void stop() {
     if (mHeaderMemRes) {
       mHeaderMemRes->stop();
@@ -118,6 +289,12 @@ class SubTimeFrameFileBuilder
   }
 
   auto& getHeaderMemRes() const { return *mHeaderMemRes; }
+  std::uint64_t headerFallbackCount() const { return mHeaderMemRes->fallbackCount(); }
+
+  void regionStats(std::vector<RegionStats> &pStats) const {
+    pStats.push_back(mHeaderMemRes->stats());
+    pStats.push_back(mDataMemRes->stats());
+  }
 
  private:
 
@@ -135,12 +312,21 @@ class TimeFrameBuilder
 {
  public:
   TimeFrameBuilder() = delete;
-  TimeFrameBuilder(FairMQChannel& pChan, const std::size_t pDataSegSize, bool pDplEnabled);
+  TimeFrameBuilder(FairMQChannel& pChan, const std::size_t pDataSegSize, const std::size_t pHdrSegSize,
+    bool pDplEnabled, const int pNumaNode = NumaUtils::cNoNode);
 
   void adaptHeaders(SubTimeFrame *pStf);
 
   FairMQMessagePtr getNewHeaderMessage(const std::size_t pSize) {
-    return mHeaderMemRes->NewFairMQMessage(pSize);
+    auto lMsg = mHeaderMemRes->NewFairMQMessageWaitFor(pSize, headerAllocWait(*mHeaderMemRes));
+    return lMsg ? std::move(lMsg) : mHeaderMemRes->NewFallbackMessage(pSize);
+  }
+
+  std::uint64_t headerFallbackCount() const { return mHeaderMemRes->fallbackCount(); }
+
+  void regionStats(std::vector<RegionStats> &pStats) const {
+    pStats.push_back(mHeaderMemRes->stats());
+    pStats.push_back(mDataMemRes->stats());
   }
 
   FairMQMessagePtr getNewDataMessage(const std::size_t pSize) {
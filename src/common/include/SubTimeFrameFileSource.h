@@ -47,6 +47,7 @@ class SubTimeFrameFileSource
   static constexpr const char* OptionKeyStfLoadRate = "data-source-rate";
   static constexpr const char* OptionKeyStfSourceRepeat = "data-source-repeat";
   static constexpr const char* OptionKeyStfSourceRegionSize = "data-source-regionsize";
+  static constexpr const char* OptionKeyStfHeadersRegionSize = "data-source-headersize";
 
 
   static bpo::options_description getProgramOptions();
@@ -79,7 +80,17 @@ class SubTimeFrameFileSource
 
   bool enabled() const { return mEnabled; }
 
-  void start(FairMQChannel& pDstChan, const bool pDplEnabled);
+  std::uint64_t headerFallbackCount() const {
+    return (mRunning && mFileBuilder) ? mFileBuilder->headerFallbackCount() : 0;
+  }
+
+  void regionStats(std::vector<RegionStats> &pStats) const {
+    if (mRunning && mFileBuilder) {
+      mFileBuilder->regionStats(pStats);
+    }
+  }
+
+  void start(FairMQChannel& pDstChan, const bool pDplEnabled, const int pNumaNode = NumaUtils::cNoNode);
   void stop();
 
   void DataHandlerThread();
@@ -96,15 +107,20 @@ class SubTimeFrameFileSource
   /// Configuration
   bool mEnabled = false;
   bool mDplEnabled = false;
+  int mNumaNode = NumaUtils::cNoNode;
   std::string mDir;
   std::vector<std::string> mFilesVector;
   bool mRepeat = false;
   float mLoadRate = 1.f;
   std::size_t mRegionSizeMB = size_t(1) << 10; /* 1GB in MiB */
+  std::size_t mHdrRegionSizeMB = 256;
 
   /// Thread for file writing
   std::atomic_bool mRunning = false;
-  ConcurrentFifo<std::unique_ptr<SubTimeFrame>> mReadStfQueue;
+
+  /// Read-ahead of the file reading thread: the reader blocks when the queue is full
+  static constexpr std::size_t cReadAheadStfs = 4;
+  ConcurrentSpscFifo<std::unique_ptr<SubTimeFrame>> mReadStfQueue{cReadAheadStfs};
   std::thread mSourceThread;
   std::thread mInjectThread;
 };
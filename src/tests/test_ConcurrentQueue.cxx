@@ -0,0 +1,414 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE "ConcurrentQueue"
+
+#include <boost/test/unit_test.hpp>
+#include <ConcurrentQueue.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace o2::DataDistribution;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_CASE(SpscFifoOrderTest)
+{
+  static constexpr std::uint64_t cCnt = 1000000;
+  ConcurrentSpscFifo<std::uint64_t> lFifo(64);
+
+  // NOTE: Boost.Test assertions are not thread safe
+  std::atomic_bool lPushFailed = false;
+  std::thread lProducer([&]() {
+    for (std::uint64_t i = 0; i < cCnt; i++) {
+      if (!lFifo.push(i)) {
+        lPushFailed = true;
+      }
+    }
+  });
+
+  std::uint64_t lExpected = 0;
+  std::uint64_t lErrors = 0;
+  std::vector<std::uint64_t> lBatch;
+  while (lExpected < cCnt) {
+    lBatch.clear();
+    if (lExpected % 2) {
+      std::uint64_t lVal;
+      BOOST_REQUIRE(lFifo.pop(lVal));
+      lBatch.push_back(lVal);
+    } else {
+      BOOST_REQUIRE(lFifo.pop_n(16, std::back_inserter(lBatch)) > 0);
+    }
+
+    for (const auto lVal : lBatch) {
+      lErrors += (lVal != lExpected++);
+    }
+  }
+
+  lProducer.join();
+  BOOST_CHECK(!lPushFailed);
+  BOOST_CHECK_EQUAL(lErrors, 0);
+  BOOST_CHECK_EQUAL(lFifo.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(SpscFifoFullBlocksTest)
+{
+  ConcurrentSpscFifo<int> lFifo(3);
+  BOOST_REQUIRE_EQUAL(lFifo.capacity(), 4); // rounded up to a power of 2
+
+  for (int i = 0; i < 4; i++) {
+    BOOST_REQUIRE(lFifo.push(i));
+  }
+
+  // the producer must block until the consumer makes room
+  auto lPushed = std::async(std::launch::async, [&]() { return lFifo.push(4); });
+  BOOST_CHECK(lPushed.wait_for(50ms) == std::future_status::timeout);
+  BOOST_CHECK_EQUAL(lFifo.size(), 4);
+
+  int lVal = -1;
+  BOOST_REQUIRE(lFifo.try_pop(lVal));
+  BOOST_CHECK_EQUAL(lVal, 0);
+
+  BOOST_REQUIRE(lPushed.wait_for(5s) == std::future_status::ready);
+  BOOST_CHECK(lPushed.get());
+
+  for (int i = 1; i <= 4; i++) {
+    BOOST_REQUIRE(lFifo.try_pop(lVal));
+    BOOST_CHECK_EQUAL(lVal, i);
+  }
+  BOOST_CHECK(!lFifo.try_pop(lVal));
+}
+
+BOOST_AUTO_TEST_CASE(SpscFifoStopWakeupTest)
+{
+  // blocked consumer
+  {
+    ConcurrentSpscFifo<int> lFifo(4);
+    auto lPopped = std::async(std::launch::async, [&]() { int lVal; return lFifo.pop(lVal); });
+    BOOST_CHECK(lPopped.wait_for(50ms) == std::future_status::timeout);
+
+    lFifo.stop();
+    BOOST_REQUIRE(lPopped.wait_for(5s) == std::future_status::ready);
+    BOOST_CHECK(!lPopped.get());
+    BOOST_CHECK(!lFifo.is_running());
+  }
+
+  // blocked producer on a full ring
+  {
+    ConcurrentSpscFifo<int> lFifo(2);
+    BOOST_REQUIRE(lFifo.push(0));
+    BOOST_REQUIRE(lFifo.push(1));
+
+    auto lPushed = std::async(std::launch::async, [&]() { return lFifo.push(2); });
+    BOOST_CHECK(lPushed.wait_for(50ms) == std::future_status::timeout);
+
+    lFifo.stop();
+    BOOST_REQUIRE(lPushed.wait_for(5s) == std::future_status::ready);
+    BOOST_CHECK(!lPushed.get());
+    BOOST_CHECK_EQUAL(lFifo.size(), 2);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(SpscFifoTryPopNWraparoundTest)
+{
+  ConcurrentSpscFifo<int> lFifo(8);
+  int lNext = 0;
+  int lExpected = 0;
+
+  // move the head and tail around the ring several times, with batches crossing the end of the slots
+  for (int lRound = 0; lRound < 20; lRound++) {
+    while (lFifo.size() < lFifo.capacity()) {
+      BOOST_REQUIRE(lFifo.push(lNext++));
+    }
+
+    std::vector<int> lOut;
+    BOOST_CHECK_EQUAL(lFifo.try_pop_n(5, std::back_inserter(lOut)), 5);
+    BOOST_CHECK_EQUAL(lFifo.size(), 3);
+
+    for (const auto lVal : lOut) {
+      BOOST_CHECK_EQUAL(lVal, lExpected++);
+    }
+  }
+
+  // more than available: returns what is queued
+  std::vector<int> lOut;
+  BOOST_CHECK_EQUAL(lFifo.try_pop_n(100, std::back_inserter(lOut)), 3);
+  for (const auto lVal : lOut) {
+    BOOST_CHECK_EQUAL(lVal, lExpected++);
+  }
+  BOOST_CHECK_EQUAL(lExpected, lNext);
+  BOOST_CHECK_EQUAL(lFifo.try_pop_n(4, std::back_inserter(lOut)), 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Pipeline stage limits
+////////////////////////////////////////////////////////////////////////////////
+
+// counts live elements, to check that dropped elements are destroyed
+struct TestElem {
+  static std::atomic_long sLive;
+
+  explicit TestElem(const std::size_t pSize) : mSize(pSize) { sLive++; }
+  ~TestElem() { sLive--; }
+
+  std::size_t mSize;
+};
+std::atomic_long TestElem::sLive = 0;
+
+using TestElemPtr = std::unique_ptr<TestElem>;
+
+// stage 0 (producer) -> stage 1 (limited, consumer) -> end
+class TestPipeline : public IFifoPipeline<TestElemPtr>
+{
+ public:
+  static constexpr unsigned cIn = 0;
+  static constexpr unsigned cOut = 1;
+
+  TestPipeline() : IFifoPipeline(2) { }
+
+  void limit(const std::size_t pMaxCount, const std::size_t pMaxBytes, const PipelineStagePolicy pPolicy)
+  {
+    mMaxCount = pMaxCount;
+    mMaxBytes = pMaxBytes;
+    mPolicy = pPolicy;
+    setStageLimit(cOut, mMaxCount, mMaxBytes, mPolicy);
+  }
+
+  std::atomic_uint64_t mDropHooks = 0;
+
+ protected:
+  unsigned getNextPipelineStage(unsigned pStage) final { return pStage + 1; }
+
+  std::size_t getPipelineElementSize(const TestElemPtr &pElem) const final { return pElem ? pElem->mSize : 0; }
+
+  void onPipelineDrop(unsigned pStage, const TestElemPtr &) final
+  {
+    mDropHooks++;
+    // the hook is called without the stage lock: taking it here must not deadlock
+    setStageLimit(pStage, mMaxCount, mMaxBytes, mPolicy);
+  }
+
+ private:
+  std::size_t mMaxCount = 0;
+  std::size_t mMaxBytes = 0;
+  PipelineStagePolicy mPolicy = eStageBlock;
+};
+
+BOOST_AUTO_TEST_CASE(PipelineStageLimitAccountingTest)
+{
+  static constexpr std::uint64_t cCnt = 20000;
+
+  for (const auto lPolicy : { eStageBlock, eStageDropOldest, eStageDropNewest }) {
+    BOOST_TEST_MESSAGE("policy=" << lPolicy);
+    {
+      TestPipeline lPipeline;
+      lPipeline.limit(8, 1000, lPolicy);
+
+      // slow consumer
+      std::atomic_uint64_t lDelivered = 0;
+      std::thread lConsumer([&]() {
+        while (auto lElem = lPipeline.dequeue(TestPipeline::cOut)) {
+          if (++lDelivered % 128 == 0) {
+            std::this_thread::sleep_for(1ms);
+          }
+        }
+      });
+
+      std::uint64_t lAccepted = 0;
+      for (std::uint64_t i = 0; i < cCnt; i++) {
+        lAccepted += lPipeline.queue(TestPipeline::cIn, std::make_unique<TestElem>(1 + i % 300));
+      }
+
+      while (lPipeline.getPipelineSize() > 0) {
+        std::this_thread::sleep_for(1ms);
+      }
+
+      const auto lStats = lPipeline.getStageStats(TestPipeline::cOut);
+      BOOST_CHECK_EQUAL(lStats.mDepth, 0);
+      BOOST_CHECK_EQUAL(lStats.mDepthBytes, 0);
+      BOOST_CHECK_EQUAL(lDelivered + lStats.mDropped, cCnt);
+      BOOST_CHECK_EQUAL(lStats.mDequeued, lDelivered);
+      BOOST_CHECK_EQUAL(lPipeline.mDropHooks, lStats.mDropped);
+
+      switch (lPolicy) {
+        case eStageBlock:
+          BOOST_CHECK_EQUAL(lStats.mDropped, 0);
+          BOOST_CHECK_EQUAL(lAccepted, cCnt);
+          break;
+        case eStageDropOldest:
+          BOOST_CHECK(lStats.mDropped > 0);
+          BOOST_CHECK_EQUAL(lAccepted, cCnt);
+          break;
+        case eStageDropNewest:
+          BOOST_CHECK(lStats.mDropped > 0);
+          BOOST_CHECK_EQUAL(lAccepted, lDelivered);
+          break;
+      }
+
+      lPipeline.stopPipeline();
+      lConsumer.join();
+    }
+    BOOST_CHECK_EQUAL(TestElem::sLive, 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(PipelineStopReleasesBlockedProducerTest)
+{
+  TestPipeline lPipeline;
+  lPipeline.limit(2, 0, eStageBlock);
+
+  BOOST_REQUIRE(lPipeline.queue(TestPipeline::cIn, std::make_unique<TestElem>(1)));
+  BOOST_REQUIRE(lPipeline.queue(TestPipeline::cIn, std::make_unique<TestElem>(1)));
+
+  auto lQueued = std::async(std::launch::async, [&]() {
+    return lPipeline.queue(TestPipeline::cIn, std::make_unique<TestElem>(1));
+  });
+  BOOST_CHECK(lQueued.wait_for(150ms) == std::future_status::timeout);
+  BOOST_CHECK_EQUAL(lPipeline.getStageStats(TestPipeline::cOut).mDepth, 2);
+
+  lPipeline.stopPipeline();
+  BOOST_REQUIRE(lQueued.wait_for(5s) == std::future_status::ready);
+  lQueued.get();
+  BOOST_CHECK_EQUAL(lPipeline.getStageDropCount(TestPipeline::cOut), 0);
+}
+
+BOOST_AUTO_TEST_CASE(StageBatchDropOldestTest)
+{
+  {
+    TestPipeline lPipeline;
+    lPipeline.limit(4, 0, eStageDropOldest);
+
+    // element sizes are used as ids
+    for (std::size_t i = 1; i <= 4; i++) {
+      BOOST_REQUIRE(lPipeline.queue(TestPipeline::cIn, std::make_unique<TestElem>(i)));
+    }
+
+    TestPipeline::StageBatch lBatch(lPipeline, TestPipeline::cOut);
+
+    // takes 1, buffers 2, 3 and 4 in the batch
+    auto lElem = lBatch.next();
+    BOOST_REQUIRE(lElem);
+    BOOST_CHECK_EQUAL(lElem->mSize, 1);
+    BOOST_CHECK_EQUAL(lPipeline.getStageStats(TestPipeline::cOut).mDepth, 3);
+
+    // the oldest elements are dropped from the batch: 2 and 3
+    for (std::size_t i = 5; i <= 7; i++) {
+      BOOST_REQUIRE(lPipeline.queue(TestPipeline::cIn, std::make_unique<TestElem>(i)));
+    }
+    BOOST_CHECK_EQUAL(lPipeline.getStageDropCount(TestPipeline::cOut), 2);
+    BOOST_CHECK_EQUAL(lPipeline.getStageStats(TestPipeline::cOut).mDepth, 4);
+
+    // try_pop drops the oldest buffered element: 4
+    BOOST_REQUIRE(lPipeline.try_pop(TestPipeline::cOut));
+    BOOST_CHECK_EQUAL(lPipeline.getStageStats(TestPipeline::cOut).mDepth, 3);
+
+    for (std::size_t i = 5; i <= 7; i++) {
+      lElem = lBatch.next();
+      BOOST_REQUIRE(lElem);
+      BOOST_CHECK_EQUAL(lElem->mSize, i);
+    }
+    lElem.reset();
+
+    const auto lStats = lPipeline.getStageStats(TestPipeline::cOut);
+    BOOST_CHECK_EQUAL(lStats.mDepth, 0);
+    BOOST_CHECK_EQUAL(lStats.mDequeued + lStats.mDropped + 1 /* try_pop */, 7);
+    BOOST_CHECK_EQUAL(lPipeline.mDropHooks, lStats.mDropped);
+    BOOST_CHECK_EQUAL(lPipeline.getPipelineSize(), 0);
+    BOOST_CHECK_EQUAL(TestElem::sLive, 0);
+  }
+  BOOST_CHECK_EQUAL(TestElem::sLive, 0);
+}
+
+BOOST_AUTO_TEST_CASE(StageBatchReleaseTest)
+{
+  TestPipeline lPipeline;
+  lPipeline.limit(8, 0, eStageBlock);
+
+  for (std::size_t i = 1; i <= 6; i++) {
+    BOOST_REQUIRE(lPipeline.queue(TestPipeline::cIn, std::make_unique<TestElem>(i)));
+  }
+
+  // elements left in a destroyed batch are returned to the stage accounting
+  {
+    TestPipeline::StageBatch lBatch(lPipeline, TestPipeline::cOut);
+    BOOST_REQUIRE(lBatch.next());
+    BOOST_CHECK_EQUAL(lPipeline.getStageStats(TestPipeline::cOut).mDepth, 5);
+  }
+  BOOST_CHECK_EQUAL(lPipeline.getStageStats(TestPipeline::cOut).mDepth, 0);
+  BOOST_CHECK_EQUAL(lPipeline.getPipelineSize(), 0);
+  BOOST_CHECK_EQUAL(TestElem::sLive, 0);
+
+  // clearPipeline() empties the batch
+  for (std::size_t i = 1; i <= 6; i++) {
+    BOOST_REQUIRE(lPipeline.queue(TestPipeline::cIn, std::make_unique<TestElem>(i)));
+  }
+  {
+    TestPipeline::StageBatch lBatch(lPipeline, TestPipeline::cOut);
+    BOOST_REQUIRE(lBatch.next());
+    lPipeline.clearPipeline();
+    BOOST_CHECK_EQUAL(lPipeline.getStageStats(TestPipeline::cOut).mDepth, 0);
+    BOOST_CHECK_EQUAL(lPipeline.getPipelineSize(), 0);
+    BOOST_CHECK_EQUAL(TestElem::sLive, 0);
+  }
+  BOOST_CHECK_EQUAL(lPipeline.getPipelineSize(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(StageBatchConcurrentDropTest)
+{
+  static constexpr std::uint64_t cCnt = 20000;
+
+  for (const auto lPolicy : { eStageBlock, eStageDropOldest, eStageDropNewest }) {
+    BOOST_TEST_MESSAGE("policy=" << lPolicy);
+
+    TestPipeline lPipeline;
+    lPipeline.limit(64, 0, lPolicy);
+
+    // slow batch consumer, elements must arrive in order
+    std::atomic_uint64_t lDelivered = 0;
+    std::atomic_uint64_t lOrderErrors = 0;
+    std::thread lConsumer([&]() {
+      TestPipeline::StageBatch lBatch(lPipeline, TestPipeline::cOut, 16);
+      std::size_t lLast = 0;
+      while (auto lElem = lBatch.next()) {
+        lOrderErrors += (lElem->mSize <= lLast);
+        lLast = lElem->mSize;
+        if (++lDelivered % 128 == 0) {
+          std::this_thread::sleep_for(1ms);
+        }
+      }
+    });
+
+    for (std::uint64_t i = 1; i <= cCnt; i++) {
+      lPipeline.queue(TestPipeline::cIn, std::make_unique<TestElem>(i));
+    }
+
+    while (lPipeline.getPipelineSize() > 0) {
+      std::this_thread::sleep_for(1ms);
+    }
+
+    const auto lStats = lPipeline.getStageStats(TestPipeline::cOut);
+    BOOST_CHECK_EQUAL(lStats.mDepth, 0);
+    BOOST_CHECK_EQUAL(lDelivered + lStats.mDropped, cCnt);
+    BOOST_CHECK_EQUAL(lPipeline.mDropHooks, lStats.mDropped);
+    BOOST_CHECK_EQUAL(lOrderErrors, 0);
+    if (lPolicy == eStageBlock) {
+      BOOST_CHECK_EQUAL(lStats.mDropped, 0);
+    }
+
+    lPipeline.stopPipeline();
+    lConsumer.join();
+    BOOST_CHECK_EQUAL(TestElem::sLive, 0);
+  }
+}
@@ -0,0 +1,211 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE "Histograms"
+
+#include <boost/test/unit_test.hpp>
+#include <Utilities.h>
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace o2::DataDistribution;
+
+static constexpr std::uint64_t cMaxVal = std::numeric_limits<std::uint64_t>::max();
+
+// largest distance of a value from the representative value of its bucket, relative to the value
+template <unsigned S>
+static bool withinErrorBound(const std::uint64_t pVal, const std::uint64_t pBucketVal)
+{
+  if (pVal < (std::uint64_t(1) << S)) {
+    return pVal == pBucketVal;
+  }
+  const auto lDiff = (pVal > pBucketVal) ? (pVal - pBucketVal) : (pBucketVal - pVal);
+  return double(lDiff) <= double(pVal) / double(std::uint64_t(1) << (S - 1));
+}
+
+template <unsigned S>
+static void checkBucketMapping()
+{
+  using Hist = PercentileHistogram<S>;
+
+  // every bucket maps back to itself, and buckets are ordered by value
+  for (std::size_t i = 0; i < Hist::cBuckets; i++) {
+    BOOST_REQUIRE_EQUAL(Hist::BucketIndex(Hist::BucketValue(i)), i);
+    if (i > 0) {
+      BOOST_REQUIRE(Hist::BucketValue(i - 1) < Hist::BucketValue(i));
+    }
+  }
+
+  // small values are exact, index does not decrease with the value
+  std::size_t lLastIdx = 0;
+  for (std::uint64_t lVal = 0; lVal < (std::uint64_t(1) << 16); lVal++) {
+    const auto lIdx = Hist::BucketIndex(lVal);
+    BOOST_REQUIRE(lIdx >= lLastIdx);
+    BOOST_REQUIRE(withinErrorBound<S>(lVal, Hist::BucketValue(lIdx)));
+    lLastIdx = lIdx;
+  }
+
+  std::mt19937_64 lGen(42);
+  for (int i = 0; i < 100000; i++) {
+    const std::uint64_t lVal = lGen() >> (lGen() % 64);
+    const auto lIdx = Hist::BucketIndex(lVal);
+    BOOST_REQUIRE(lIdx < Hist::cBuckets);
+    BOOST_REQUIRE(withinErrorBound<S>(lVal, Hist::BucketValue(lIdx)));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(PercentileHistogramBucketMappingTest)
+{
+  checkBucketMapping<2>();
+  checkBucketMapping<7>();
+  checkBucketMapping<12>();
+}
+
+template <unsigned S>
+static void checkEdgeValues()
+{
+  using Hist = PercentileHistogram<S>;
+  constexpr std::uint64_t cLinear = std::uint64_t(1) << S;
+
+  BOOST_CHECK_EQUAL(Hist::BucketIndex(0), 0);
+  BOOST_CHECK_EQUAL(Hist::BucketValue(0), 0);
+
+  // last exact bucket
+  BOOST_CHECK_EQUAL(Hist::BucketIndex(cLinear - 1), cLinear - 1);
+  BOOST_CHECK_EQUAL(Hist::BucketValue(cLinear - 1), cLinear - 1);
+
+  // first log-linear bucket: [2^S, 2^S + 2)
+  BOOST_CHECK_EQUAL(Hist::BucketIndex(cLinear), cLinear);
+  BOOST_CHECK_EQUAL(Hist::BucketIndex(cLinear + 1), cLinear);
+  BOOST_CHECK_EQUAL(Hist::BucketIndex(cLinear + 2), cLinear + 1);
+  BOOST_CHECK(withinErrorBound<S>(cLinear, Hist::BucketValue(cLinear)));
+
+  // the largest value is in the last bucket, without overflow of the bucket value
+  BOOST_CHECK_EQUAL(Hist::BucketIndex(cMaxVal), Hist::cBuckets - 1);
+  BOOST_CHECK(Hist::BucketValue(Hist::cBuckets - 1) > cMaxVal - (cMaxVal >> S));
+  BOOST_CHECK(withinErrorBound<S>(cMaxVal, Hist::BucketValue(Hist::cBuckets - 1)));
+
+  Hist lHist;
+  for (const auto lVal : { std::uint64_t(0), cLinear - 1, cLinear, cMaxVal }) {
+    lHist.Fill(lVal);
+  }
+  const auto lTotal = lHist.Total();
+  BOOST_CHECK_EQUAL(lTotal.Count(), 4);
+  BOOST_CHECK_EQUAL(lTotal.Quantile(0.0), 0);
+  BOOST_CHECK_EQUAL(lTotal.Quantile(1.0), Hist::BucketValue(Hist::cBuckets - 1));
+}
+
+BOOST_AUTO_TEST_CASE(PercentileHistogramEdgeValuesTest)
+{
+  checkEdgeValues<2>();
+  checkEdgeValues<7>();
+  checkEdgeValues<15>();
+}
+
+BOOST_AUTO_TEST_CASE(PercentileHistogramQuantileErrorTest)
+{
+  constexpr unsigned cS = 7;
+  PercentileHistogram<cS> lHist;
+
+  // log-normal values, spanning several orders of magnitude
+  std::mt19937_64 lGen(7);
+  std::lognormal_distribution<double> lDist(10.0, 2.0);
+  std::vector<std::uint64_t> lValues;
+  for (int i = 0; i < 200000; i++) {
+    const auto lVal = std::uint64_t(lDist(lGen));
+    lValues.push_back(lVal);
+    lHist.Fill(lVal);
+  }
+  std::sort(lValues.begin(), lValues.end());
+
+  const auto lTotal = lHist.Total();
+  BOOST_REQUIRE_EQUAL(lTotal.Count(), lValues.size());
+
+  for (const double lQuantile : { 0.0, 0.001, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999, 1.0 }) {
+    const auto lExact = lValues[std::size_t(lQuantile * double(lValues.size() - 1))];
+    const auto lEstimate = lTotal.Quantile(lQuantile);
+    BOOST_TEST_MESSAGE("q=" << lQuantile << " exact=" << lExact << " estimate=" << lEstimate);
+    BOOST_CHECK(withinErrorBound<cS>(lExact, lEstimate));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(PercentileHistogramWindowTest)
+{
+  PercentileHistogram<> lHist;
+
+  // empty window
+  auto lWindow = lHist.Window();
+  BOOST_CHECK_EQUAL(lWindow.Count(), 0);
+  BOOST_CHECK_EQUAL(lWindow.Quantile(0.5), 0);
+  BOOST_CHECK_EQUAL(lWindow.Mean(), 0.0);
+
+  for (int i = 0; i < 1000; i++) {
+    lHist.Fill(10);
+  }
+  lWindow = lHist.Window();
+  BOOST_CHECK_EQUAL(lWindow.Count(), 1000);
+  BOOST_CHECK_EQUAL(lWindow.Mean(), 10.0);
+  BOOST_CHECK_EQUAL(lWindow.Quantile(0.99), 10);
+
+  // the next window only has the new samples
+  for (int i = 0; i < 100; i++) {
+    lHist.Fill(20);
+  }
+  lWindow = lHist.Window();
+  BOOST_CHECK_EQUAL(lWindow.Count(), 100);
+  BOOST_CHECK_EQUAL(lWindow.Mean(), 20.0);
+  BOOST_CHECK_EQUAL(lWindow.Quantile(0.0), 20);
+  BOOST_CHECK(lWindow.Duration() >= 0.0);
+
+  lWindow = lHist.Window();
+  BOOST_CHECK_EQUAL(lWindow.Count(), 0);
+  BOOST_CHECK_EQUAL(lWindow.Quantile(1.0), 0);
+
+  // the total is not affected by the windows
+  const auto lTotal = lHist.Total();
+  BOOST_CHECK_EQUAL(lTotal.Count(), 1100);
+  BOOST_CHECK_EQUAL(lTotal.Quantile(0.5), 10);
+  BOOST_CHECK_EQUAL(lTotal.Quantile(1.0), 20);
+}
+
+BOOST_AUTO_TEST_CASE(Log2HistogramTest)
+{
+  using Hist = Log2Histogram<33>;
+
+  const auto lBucketOf = [](const std::uint64_t pVal) {
+    Hist lHist;
+    lHist.Fill(pVal);
+    const auto lSnap = lHist.Snapshot();
+    return std::size_t(std::find(lSnap.begin(), lSnap.end(), 1) - lSnap.begin());
+  };
+
+  // bucket i counts [2^(i-1), 2^i), bucket 0 counts zeros, the last bucket is open
+  BOOST_CHECK_EQUAL(lBucketOf(0), 0);
+  BOOST_CHECK_EQUAL(lBucketOf(1), 1);
+  for (std::size_t i = 1; i < 32; i++) {
+    BOOST_CHECK_EQUAL(lBucketOf(Hist::BucketLimit(i) - 1), i);
+    BOOST_CHECK_EQUAL(lBucketOf(Hist::BucketLimit(i)), i + 1);
+  }
+  BOOST_CHECK_EQUAL(lBucketOf(cMaxVal), Hist::cBuckets - 1);
+
+  // quantiles report the upper bound of the bucket
+  Hist lHist;
+  BOOST_CHECK_EQUAL(Hist::Quantile(lHist.Snapshot(), 0.5), 0);
+  for (int i = 0; i < 99; i++) {
+    lHist.Fill(100); // [64, 128)
+  }
+  lHist.Fill(5000); // [4096, 8192)
+  BOOST_CHECK_EQUAL(Hist::Quantile(lHist.Snapshot(), 0.5), 128);
+  BOOST_CHECK_EQUAL(Hist::Quantile(lHist.Snapshot(), 1.0), 8192);
+}